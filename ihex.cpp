@@ -3,6 +3,7 @@
 //
 // this software is distributed under the license: GPLv2 (http://www.gnu.org/licenses/gpl-2.0.html)
 
+#include "libihex.hpp"
 #include <iostream>
 #include <fstream>
 #include <sstream>
@@ -10,587 +11,754 @@
 #include <vector>
 #include <set>
 #include <memory>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <ctype.h>
+#include <string.h>
 #include <stdint.h>
 #include <getopt.h>
-
-class not_implemented : public std::exception
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef HAVE_ZLIB
+	#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+	#include <zstd.h>
+#endif
+
+using namespace ihex;
+
+/// Bounded queue for exactly one producer and one consumer thread. Items are
+/// handed over lock free, a side finding the queue full or empty respectively
+/// spins briefly and then blocks until the other side made progress.
+/// The capacity limits the memory in use.
+template <class T> class Queue
 {
-	public:
-		const char * file;
-		int line;
-		std::string text;
 	private:
-		void update(void)
-		{
-			std::ostringstream os;
-			os << "NOT IMPLEMENTED: " << file << ":" << line;
-			text = os.str();
-		}
-	public:
-		not_implemented(const char * file, int line)
-			: file(file)
-			, line(line)
-		{
-			update();
-		}
+		static const int SPIN_COUNT = 64;
 
-		virtual ~not_implemented() throw () {}
+		std::vector<T> items;
+		std::atomic<size_t> head; // next item to pop, written by the consumer only
+		std::atomic<size_t> tail; // next free slot, written by the producer only
+		std::atomic<int> waiting; // number of blocked threads
+		std::mutex mutex;
+		std::condition_variable cond;
 
-		virtual const char * what() const throw()
-		{
-			return text.c_str();
-		}
+		template <class Predicate> void wait(Predicate);
+		void notify(void);
+	public:
+		explicit Queue(size_t);
+		void push(T &&);
+		T pop(void);
 };
 
-inline uint8_t h2b(char h)
+template <class T> Queue<T>::Queue(size_t capacity)
+	: items(capacity + 1)
+	, head(0)
+	, tail(0)
+	, waiting(0)
+{}
+
+template <class T> template <class Predicate> void Queue<T>::wait(Predicate ready)
 {
-	if (h >= '0' && h <= '9') return h-'0';
-	if (h >= 'A' && h <= 'F') return h-'A'+10;
-	if (h >= 'a' && h <= 'f') return h-'a'+10;
-	return 0x00;
+	for (int i = 0; i < SPIN_COUNT; ++i) {
+		if (ready()) return;
+		std::this_thread::yield();
+	}
+	std::unique_lock<std::mutex> lock(mutex);
+	++waiting;
+	cond.wait(lock, ready);
+	--waiting;
 }
 
-std::istringstream & operator >> (std::istringstream & is, uint8_t & val)
+/// Wakes up the other side, if blocked. The index was stored before, either
+/// the blocked thread sees it or this thread sees the thread waiting.
+template <class T> void Queue<T>::notify(void)
 {
-	char t;
-
-	val = 0;
-	is >> t;
-	val += h2b(t);
-	val <<= 4;
-	is >> t;
-	val += h2b(t);
-	return is;
+	if (!waiting.load()) return;
+	std::lock_guard<std::mutex> lock(mutex);
+	cond.notify_all();
 }
 
-std::istringstream & operator >> (std::istringstream & is, uint16_t & val)
+template <class T> void Queue<T>::push(T && item)
 {
-	uint8_t t;
+	const size_t t = tail.load(std::memory_order_relaxed);
+	const size_t next = (t + 1) % items.size();
+	wait([&]() { return next != head.load(); });
+	items[t] = std::move(item);
+	tail.store(next);
+	notify();
+}
 
-	val = 0;
-	is >> t;
-	val += t;
-	val <<= 8;
-	is >> t;
-	val += t;
-	return is;
+template <class T> T Queue<T>::pop(void)
+{
+	const size_t h = head.load(std::memory_order_relaxed);
+	wait([&]() { return h != tail.load(); });
+	T item = std::move(items[h]);
+	head.store((h + 1) % items.size());
+	notify();
+	return item;
 }
 
-class Record
+/// Reads records from the input and writes them as intel hex to the output,
+/// without holding the entire data in memory. Reading, decoding and writing
+/// run in their own threads, connected by bounded queues: output is written
+/// as soon as a region is complete. Exceptions of the decoder are rethrown.
+static void stream_ihex(std::istream & is, std::ostream & os, unsigned int width, unsigned int page_size)
 {
-	public:
-		enum Type : uint8_t {
-			 DATA              = 0x00
-			,END_OF_FILE       = 0x01
-			,EXT_SEG_ADDRESS   = 0x02
-			,START_SEG_ADDRESS = 0x03
-			,EXT_LIN_ADDRESS   = 0x04
-			,START_LIN_ADDRESS = 0x05
-		};
-
-		typedef uint8_t value_type;
-		typedef std::vector<value_type> Data;
-		typedef Data::size_type size_type;
-		typedef uint8_t checksum_type;
-		typedef uint16_t offset_type;
-		typedef uint32_t address_type;
-		typedef Data::const_iterator const_iterator;
-
-		class checksum_exception : public std::exception
-		{
-			public:
-				checksum_type checksum;
-				checksum_type calculated;
-				int line;
-			public:
-				checksum_exception(checksum_type checksum, checksum_type calculated)
-					: checksum(checksum)
-					, calculated(calculated)
-					, line(-1)
-				{}
-
-				checksum_exception(const checksum_exception & ex, int line)
-					: checksum(ex.checksum)
-					, calculated(ex.calculated)
-					, line(line)
-				{}
-		};
-
-		class unknown_type_exception : public std::exception
-		{
-			public:
-				Type type;
-			public:
-				unknown_type_exception(Type type)
-					: type(type)
-				{}
-		};
-	private:
-		offset_type off;
-		Type t;
-		Data bytes;
-	public:
-		Record(void);
-		explicit Record(Type);
-		explicit Record(address_type);
+	using namespace std;
 
-		void push_back(value_type);
+	static const size_t BLOCK_SIZE = 64 * 1024;
 
-		Type type(void) const;
-		checksum_type checksum(void) const;
-		size_type size(void) const;
-		offset_type offset(void) const;
+	Queue<string> blocks(16); // empty block: end of input
+	Queue<unique_ptr<Region>> regions(16); // null: end of data
+	exception_ptr error;
 
-		const_iterator begin(void) const;
-		const_iterator end(void) const;
+	// the input must not flush the output, which is used by another thread
+	ostream * tie = is.tie(nullptr);
 
-		address_type address(void) const;
+	thread reader([&]() {
+		for (;;) {
+			string block(BLOCK_SIZE, '\0');
+			is.read(&block[0], block.size());
+			block.resize(is.gcount());
+			if (block.empty()) break;
+			blocks.push(move(block));
+		}
+		blocks.push(string());
+	});
+
+	Parser parser;
+	thread decoder([&]() {
+		auto emit = [&regions](const Region & region) { regions.push(unique_ptr<Region>(new Region(region))); };
+
+		bool done = false;
+		string block;
+		do {
+			block = blocks.pop();
+			if (done) continue; // drain the input
+			try {
+				if (block.size()) {
+					done = !parser.parse(block.data(), block.size(), emit);
+				} else {
+					parser.finish(emit);
+				}
+			} catch (...) {
+				error = current_exception();
+				done = true;
+			}
+		} while (block.size());
+		regions.push(unique_ptr<Region>());
+	});
 
-		static Record create_data(address_type);
-		static Record eof(void);
+	for (unique_ptr<Region> region = regions.pop(); region; region = regions.pop()) {
+		region->dump_ihex(os, width, page_size);
+		os.flush();
+	}
 
-		friend std::istream & operator >> (std::istream &, Record &) throw (checksum_exception, unknown_type_exception);
-		friend std::ostream & operator << (std::ostream &, const Record &);
-};
+	decoder.join();
+	reader.join();
+	is.tie(tie);
 
-Record Record::create_data(address_type address)
-{
-	Record rec(Type::DATA);
-	rec.off = address & 0xffff;
-	return rec;
+	if (error) rethrow_exception(error);
+	if (parser.start_address().type() != Record::Type::END_OF_FILE) os << parser.start_address();
+	os << Record::eof();
 }
 
-Record Record::eof(void)
+/// Stream buffer which decompresses data read from, or compresses data
+/// written to, another stream buffer. Output buffers do not flush the
+/// compressed stream on sync, to keep the compression ratio independent
+/// of flushes of the output stream.
+class FilterBuffer : public std::streambuf
 {
-	return Record(Type::END_OF_FILE);
-}
+	protected:
+		static const size_t BUFFER_SIZE = 64 * 1024;
 
-Record::Record(void)
-	: off(0)
-	, t(Type::END_OF_FILE)
-{}
+		bool failed;
+	public:
+		FilterBuffer(void) : failed(false) {}
+		virtual ~FilterBuffer() {}
 
-Record::Record(Type type)
-	: off(0)
-	, t(type)
-{}
+		/// Completes the compressed stream, no more data may be written.
+		virtual void finish(void) {}
 
-Record::Record(address_type address)
-	: off(0)
-	, t(Type::EXT_LIN_ADDRESS)
-{
-	bytes.reserve(2);
-	bytes.push_back((address >> 24) & 0xff);
-	bytes.push_back((address >> 16) & 0xff);
-}
+		/// Returns true if the data was corrupt or could not be written.
+		bool fail(void) const { return failed; }
+};
 
-Record::address_type Record::address(void) const
+#ifdef HAVE_ZLIB
+class GzipInputBuffer : public FilterBuffer
 {
-	if (bytes.size() < 2) return 0;
-	address_type address = 0;
-	address += bytes[0];
-	address <<= 8;
-	address += bytes[1];
-	address <<= 16;
-	return address;
-}
+	private:
+		std::streambuf * source;
+		z_stream z;
+		bool complete; // end of a compressed stream reached
+		std::vector<char> in;
+		std::vector<char> out;
+	protected:
+		virtual int_type underflow(void);
+	public:
+		explicit GzipInputBuffer(std::streambuf *);
+		virtual ~GzipInputBuffer();
+};
 
-Record::const_iterator Record::begin(void) const
+GzipInputBuffer::GzipInputBuffer(std::streambuf * source)
+	: source(source)
+	, complete(true)
+	, in(BUFFER_SIZE)
+	, out(BUFFER_SIZE)
 {
-	return bytes.begin();
+	memset(&z, 0, sizeof(z));
+	if (inflateInit2(&z, 15 + 32) != Z_OK) failed = true; // gzip or zlib header
+	setg(out.data(), out.data(), out.data());
 }
 
-Record::const_iterator Record::end(void) const
+GzipInputBuffer::~GzipInputBuffer()
 {
-	return bytes.end();
+	inflateEnd(&z);
 }
 
-Record::size_type Record::size(void) const
+GzipInputBuffer::int_type GzipInputBuffer::underflow(void)
 {
-	return bytes.size();
-}
+	if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
 
-Record::Type Record::type(void) const
-{
-	return t;
+	while (!failed) {
+		if (z.avail_in == 0) {
+			const std::streamsize n = source->sgetn(in.data(), in.size());
+			if (n <= 0) {
+				if (!complete) failed = true; // truncated
+				break;
+			}
+			z.next_in = reinterpret_cast<Bytef *>(in.data());
+			z.avail_in = static_cast<uInt>(n);
+		}
+
+		z.next_out = reinterpret_cast<Bytef *>(out.data());
+		z.avail_out = static_cast<uInt>(out.size());
+		const int rc = inflate(&z, Z_NO_FLUSH);
+		if (rc == Z_STREAM_END) {
+			complete = true;
+			inflateReset(&z); // concatenated gzip members
+		} else if (rc == Z_OK || rc == Z_BUF_ERROR) {
+			complete = false;
+		} else {
+			failed = true;
+		}
+
+		const size_t n = out.size() - z.avail_out;
+		if (n) {
+			setg(out.data(), out.data(), out.data() + n);
+			return traits_type::to_int_type(*gptr());
+		}
+	}
+	return traits_type::eof();
 }
 
-Record::offset_type Record::offset(void) const
+class GzipOutputBuffer : public FilterBuffer
 {
-	return off;
-}
+	private:
+		std::streambuf * sink;
+		z_stream z;
+		bool finished;
+		std::vector<char> in;
+		std::vector<char> out;
+
+		void compress(int);
+	protected:
+		virtual int_type overflow(int_type);
+		virtual int sync(void);
+	public:
+		explicit GzipOutputBuffer(std::streambuf *);
+		virtual ~GzipOutputBuffer();
+		virtual void finish(void);
+};
 
-void Record::push_back(value_type val)
+GzipOutputBuffer::GzipOutputBuffer(std::streambuf * sink)
+	: sink(sink)
+	, finished(false)
+	, in(BUFFER_SIZE)
+	, out(BUFFER_SIZE)
 {
-	bytes.push_back(val);
+	memset(&z, 0, sizeof(z));
+	if (deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) failed = true;
+	setp(in.data(), in.data() + in.size());
 }
 
-Record::checksum_type Record::checksum(void) const
+GzipOutputBuffer::~GzipOutputBuffer()
 {
-	checksum_type sum = 0;
-	sum += static_cast<checksum_type>(bytes.size());
-	sum += (off >> 8) & 0xff;
-	sum += (off >> 0) & 0xff;
-	sum += static_cast<uint16_t>(type());
-	for (auto i = bytes.begin(); i != bytes.end(); ++i) {
-		sum += *i;
-	}
-	return -sum;
+	finish();
+	deflateEnd(&z);
 }
 
-std::istream & operator >> (std::istream & is, Record & rec)
-		throw (Record::checksum_exception, Record::unknown_type_exception)
+/// Compresses the pending data of the put area.
+void GzipOutputBuffer::compress(int flush)
 {
-	using namespace std;
-
-	uint8_t len;
-	uint8_t type;
-	Record::checksum_type checksum;
-
-	string line;
-	getline(is, line);
-	istringstream iss(line);
-
-	char mark;
-	iss >> mark; // consume leading colon ':'
-
-	iss >> len;
-	iss >> rec.off;
-	iss >> type;
-
-	Record::Type rtype = static_cast<Record::Type>(type);
-	switch (rtype) {
-		case Record::Type::END_OF_FILE:
-		case Record::Type::EXT_LIN_ADDRESS:
-		case Record::Type::DATA:
+	z.next_in = reinterpret_cast<Bytef *>(pbase());
+	z.avail_in = static_cast<uInt>(pptr() - pbase());
+	for (;;) {
+		z.next_out = reinterpret_cast<Bytef *>(out.data());
+		z.avail_out = static_cast<uInt>(out.size());
+		const int rc = deflate(&z, flush);
+		const std::streamsize n = out.size() - z.avail_out;
+		if ((rc != Z_OK && rc != Z_STREAM_END && rc != Z_BUF_ERROR) || sink->sputn(out.data(), n) != n) {
+			failed = true;
 			break;
-		case Record::Type::EXT_SEG_ADDRESS:
-		case Record::Type::START_SEG_ADDRESS:
-		case Record::Type::START_LIN_ADDRESS:
-			throw not_implemented(__FILE__, __LINE__);
-		default:
-			throw Record::unknown_type_exception(rtype);
-	}
-
-	rec.t = rtype;
-
-	rec.bytes.clear();
-	rec.bytes.reserve(len);
-	for (uint8_t i = 0; i < len; ++i) {
-		Record::value_type b;
-		iss >> b;
-		rec.bytes.push_back(b);
+		}
+		if ((flush == Z_FINISH) ? (rc == Z_STREAM_END) : (z.avail_in == 0 && z.avail_out != 0)) break;
 	}
-	iss >> checksum;
-
-	if (checksum != rec.checksum()) throw Record::checksum_exception(checksum, rec.checksum());
-
-	return is;
+	setp(in.data(), in.data() + in.size());
 }
 
-std::ostream & operator << (std::ostream & os, const Record & rec)
-{
-	using namespace std;
-
-	os	<< ":"
-		<< setbase(16)
-		<< uppercase
-		<< setfill('0')
-		<< setw(2)
-		<< rec.size()
-		<< setw(4)
-		<< rec.offset()
-		<< setw(2)
-		<< rec.type()
-		;
-	for (auto i = rec.bytes.begin(); i != rec.bytes.end(); ++i) {
-		os	<< setbase(16)
-			<< uppercase
-			<< setfill('0')
-			<< setw(2)
-			<< static_cast<int>(*i)
-			;
-	}
-	os	<< setbase(16)
-		<< uppercase
-		<< setfill('0')
-		<< setw(2)
-		<< static_cast<int>(rec.checksum())
-		<< endl
-		;
-	return os;
-}
-
-class Region
-{
-	public:
-		class continuous_exception : public std::exception {};
-		typedef Record::address_type address_type;
-	private:
-		typedef Record::value_type value_type;
-		typedef std::vector<value_type> Data;
-		typedef Record::offset_type offset_type;
-	public:
-		typedef Data::size_type size_type;
-	private:
-		Data data; // max size 64kB, since offset of hex file is 16 bits
-		address_type base_address;
-		offset_type offset;
-		bool offset_already_set;
-	public:
-		Region(address_type = 0);
-		void insert(offset_type, value_type) throw (continuous_exception);
-		size_type size(void) const;
-		void dump_data(std::ostream &, unsigned int = 16) const;
-		void dump_ihex(std::ostream &, unsigned int = 32) const;
-		address_type address(void) const;
-		void move_base_address(address_type);
-		bool inside(address_type) const;
-};
-
-Region::Region(address_type base_address)
-	: base_address(base_address)
-	, offset(0)
-	, offset_already_set(false)
-{}
-
-Region::address_type Region::address(void) const
+GzipOutputBuffer::int_type GzipOutputBuffer::overflow(int_type c)
 {
-	return base_address + offset;
+	if (failed || finished) return traits_type::eof();
+	compress(Z_NO_FLUSH);
+	if (!traits_type::eq_int_type(c, traits_type::eof())) sputc(traits_type::to_char_type(c));
+	return failed ? traits_type::eof() : traits_type::not_eof(c);
 }
 
-void Region::move_base_address(address_type destination_base_address)
+int GzipOutputBuffer::sync(void)
 {
-	base_address = destination_base_address & 0xffff0000;
-	offset = destination_base_address & 0x0000ffff;
+	if (!failed && !finished) compress(Z_NO_FLUSH);
+	return failed ? -1 : 0;
 }
 
-bool Region::inside(address_type address) const
+void GzipOutputBuffer::finish(void)
 {
-	return true
-		&& (address >= base_address + offset)
-		&& (address < base_address + offset - size())
-		;
+	if (finished || failed) return;
+	compress(Z_FINISH);
+	finished = true;
+	if (sink->pubsync() != 0) failed = true;
 }
+#endif
 
-void Region::insert(offset_type value_offset, value_type value) throw (continuous_exception)
+#ifdef HAVE_ZSTD
+class ZstdInputBuffer : public FilterBuffer
 {
-	if (offset_already_set) {
-		if (value_offset < offset) throw continuous_exception();
-		if (value_offset > data.size() + offset) throw continuous_exception();
-	} else {
-		offset = value_offset;
-		offset_already_set = true;
-	}
-	data.push_back(value);
-}
+	private:
+		std::streambuf * source;
+		ZSTD_DStream * z;
+		ZSTD_inBuffer input;
+		size_t pending; // hint of the decoder, zero at the end of a frame
+		std::vector<char> in;
+		std::vector<char> out;
+	protected:
+		virtual int_type underflow(void);
+	public:
+		explicit ZstdInputBuffer(std::streambuf *);
+		virtual ~ZstdInputBuffer();
+};
 
-Region::size_type Region::size(void) const
+ZstdInputBuffer::ZstdInputBuffer(std::streambuf * source)
+	: source(source)
+	, z(ZSTD_createDStream())
+	, pending(0)
+	, in(ZSTD_DStreamInSize())
+	, out(ZSTD_DStreamOutSize())
 {
-	return data.size();
+	if (!z || ZSTD_isError(ZSTD_initDStream(z))) failed = true;
+	input.src = in.data();
+	input.size = 0;
+	input.pos = 0;
+	setg(out.data(), out.data(), out.data());
 }
 
-void Region::dump_data(std::ostream & os, unsigned int width) const
+ZstdInputBuffer::~ZstdInputBuffer()
 {
-	size_type count = 0;
-	address_type address = base_address + offset;
-
-	os << std::setbase(16) << std::resetiosflags(std::ios::showbase);
-	for (auto i = data.begin(); i != data.end(); ++i, ++address) {
-		if (count >= width) {
-			count = 0;
-			os << std::endl;
-		}
-		if (count == 0) {
-			os << "0x" << std::setfill('0') << std::setw(8) << address << " :";
-		}
-		os << " " << std::setfill('0') << std::setw(2) << static_cast<int>(*i);
-		++count;
-	}
-	os << std::endl;
+	ZSTD_freeDStream(z);
 }
 
-void Region::dump_ihex(std::ostream & os, unsigned int width) const
+ZstdInputBuffer::int_type ZstdInputBuffer::underflow(void)
 {
-	enum class State {
-		 NEW_RECORD
-		,DATA
-	};
-
-	address_type address = base_address;
-	State state = State::NEW_RECORD;
-	Record rec;
+	if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
 
-	os << Record(address);
-	for (auto i = data.begin(); i != data.end();) {
-		switch (state) {
-			case State::NEW_RECORD:
-				rec = Record::create_data(address + offset);
-				state = State::DATA;
+	while (!failed) {
+		if (input.pos == input.size) {
+			const std::streamsize n = source->sgetn(in.data(), in.size());
+			if (n <= 0) {
+				if (pending) failed = true; // truncated
 				break;
+			}
+			input.size = static_cast<size_t>(n);
+			input.pos = 0;
+		}
 
-			case State::DATA:
-				if (rec.size() >= width) {
-					os << rec;
-					state = State::NEW_RECORD;
-					break;
-				}
-				rec.push_back(*i);
-				++address;
-				++i;
-				if (i == data.end()) {
-					os << rec;
-				}
-				break;
+		ZSTD_outBuffer output = { out.data(), out.size(), 0 };
+		pending = ZSTD_decompressStream(z, &output, &input);
+		if (ZSTD_isError(pending)) {
+			failed = true;
+			break;
+		}
+		if (output.pos) {
+			setg(out.data(), out.data(), out.data() + output.pos);
+			return traits_type::to_int_type(*gptr());
 		}
 	}
+	return traits_type::eof();
 }
 
-class HexData
+class ZstdOutputBuffer : public FilterBuffer
 {
 	private:
-		typedef std::vector<Region> Data;
-	public:
-		typedef Data::const_iterator const_iterator;
-		typedef Data::iterator iterator;
-	private:
-		Data data;
+		std::streambuf * sink;
+		ZSTD_CStream * z;
+		bool finished;
+		std::vector<char> in;
+		std::vector<char> out;
+
+		void compress(bool);
+	protected:
+		virtual int_type overflow(int_type);
+		virtual int sync(void);
 	public:
-		HexData();
-		void read_records(std::istream & is) throw (Record::checksum_exception);
-		void dump_data(std::ostream &, unsigned int = 16) const;
-		void dump_ihex(std::ostream &, unsigned int = 32) const;
-
-		const_iterator find(Region::address_type) const;
-		const_iterator begin(void) const;
-		const_iterator end(void) const;
-
-		iterator find(Region::address_type);
-		iterator begin(void);
-		iterator end(void);
-		void erase(iterator);
+		explicit ZstdOutputBuffer(std::streambuf *);
+		virtual ~ZstdOutputBuffer();
+		virtual void finish(void);
 };
 
-HexData::HexData()
-{}
-
-HexData::const_iterator HexData::begin(void) const
+ZstdOutputBuffer::ZstdOutputBuffer(std::streambuf * sink)
+	: sink(sink)
+	, z(ZSTD_createCStream())
+	, finished(false)
+	, in(ZSTD_CStreamInSize())
+	, out(ZSTD_CStreamOutSize())
 {
-	return data.begin();
+	if (!z || ZSTD_isError(ZSTD_initCStream(z, 3))) failed = true;
+	setp(in.data(), in.data() + in.size());
 }
 
-HexData::const_iterator HexData::end(void) const
+ZstdOutputBuffer::~ZstdOutputBuffer()
 {
-	return data.end();
+	finish();
+	ZSTD_freeCStream(z);
 }
 
-HexData::iterator HexData::begin(void)
+/// Compresses the pending data of the put area, and ends the frame if requested.
+void ZstdOutputBuffer::compress(bool end)
 {
-	return data.begin();
+	ZSTD_inBuffer input = { pbase(), static_cast<size_t>(pptr() - pbase()), 0 };
+	for (;;) {
+		ZSTD_outBuffer output = { out.data(), out.size(), 0 };
+		const size_t rc = (input.pos < input.size || !end)
+			? ZSTD_compressStream(z, &output, &input)
+			: ZSTD_endStream(z, &output);
+		const std::streamsize n = output.pos;
+		if (ZSTD_isError(rc) || sink->sputn(out.data(), n) != n) {
+			failed = true;
+			break;
+		}
+		if (input.pos == input.size && (!end || rc == 0) && (end || output.pos < output.size)) break;
+	}
+	setp(in.data(), in.data() + in.size());
 }
 
-HexData::iterator HexData::end(void)
+ZstdOutputBuffer::int_type ZstdOutputBuffer::overflow(int_type c)
 {
-	return data.end();
+	if (failed || finished) return traits_type::eof();
+	compress(false);
+	if (!traits_type::eq_int_type(c, traits_type::eof())) sputc(traits_type::to_char_type(c));
+	return failed ? traits_type::eof() : traits_type::not_eof(c);
 }
 
-HexData::const_iterator HexData::find(Region::address_type address) const
+int ZstdOutputBuffer::sync(void)
 {
-	for (auto i = data.begin(); i != data.end(); ++i) {
-		if (i->address() == address) return i;
-	}
-	return end();
+	if (!failed && !finished) compress(false);
+	return failed ? -1 : 0;
 }
 
-HexData::iterator HexData::find(Region::address_type address)
+void ZstdOutputBuffer::finish(void)
 {
-	for (auto i = data.begin(); i != data.end(); ++i) {
-		if (i->address() == address) return i;
-	}
-	return end();
+	if (finished || failed) return;
+	compress(true);
+	finished = true;
+	if (sink->pubsync() != 0) failed = true;
 }
+#endif
+
+enum class Compression {
+	 NONE
+	,GZIP
+	,ZSTD
+};
 
-void HexData::erase(iterator i)
+/// Determines the compression of a file by its extension.
+static Compression compression(const std::string & filename)
 {
-	data.erase(i);
+	auto ends_with = [&filename](const std::string & suffix) {
+		return filename.size() >= suffix.size()
+			&& filename.compare(filename.size() - suffix.size(), suffix.size(), suffix) == 0;
+	};
+	if (ends_with(".gz")) return Compression::GZIP;
+	if (ends_with(".zst")) return Compression::ZSTD;
+	return Compression::NONE;
 }
 
-void HexData::dump_data(std::ostream & os, unsigned int width) const
+/// Returns a stream buffer decompressing the data of the source, null if
+/// the compression is not supported by this build.
+static std::unique_ptr<FilterBuffer> create_input_filter(Compression type, std::streambuf * source)
 {
-	for (auto i = data.begin(); i != data.end(); ++i) {
-		i->dump_data(os, width);
+	switch (type) {
+#ifdef HAVE_ZLIB
+		case Compression::GZIP:
+			return std::unique_ptr<FilterBuffer>(new GzipInputBuffer(source));
+#endif
+#ifdef HAVE_ZSTD
+		case Compression::ZSTD:
+			return std::unique_ptr<FilterBuffer>(new ZstdInputBuffer(source));
+#endif
+		default:
+			(void)source;
+			return std::unique_ptr<FilterBuffer>();
 	}
 }
 
-void HexData::dump_ihex(std::ostream & os, unsigned int width) const
+/// Returns a stream buffer compressing the data into the sink, null if
+/// the compression is not supported by this build.
+static std::unique_ptr<FilterBuffer> create_output_filter(Compression type, std::streambuf * sink)
 {
-	for (auto i = data.begin(); i != data.end(); ++i) {
-		i->dump_ihex(os, width);
+	switch (type) {
+#ifdef HAVE_ZLIB
+		case Compression::GZIP:
+			return std::unique_ptr<FilterBuffer>(new GzipOutputBuffer(sink));
+#endif
+#ifdef HAVE_ZSTD
+		case Compression::ZSTD:
+			return std::unique_ptr<FilterBuffer>(new ZstdOutputBuffer(sink));
+#endif
+		default:
+			(void)sink;
+			return std::unique_ptr<FilterBuffer>();
 	}
-	os << Record::eof();
 }
 
-void HexData::read_records(std::istream & is) throw (Record::checksum_exception)
+/// Completes the compressed output, returns false if it could not be written.
+static bool finish_output(std::ostream & os, FilterBuffer * filter)
 {
-	Region region;
+	os.flush();
+	if (!filter) return true;
+	filter->finish();
+	return !filter->fail();
+}
 
-	int line = 0;
-	while (!is.eof()) {
-		++line;
+/// Restores the original buffer of a standard stream on every exit path.
+/// Must be declared after the buffers installed into the stream, so that
+/// the stream never refers to a destroyed buffer.
+class StreamBufferGuard
+{
+	private:
+		std::ios & stream;
+		std::streambuf * buffer;
 
-		Record rec;
+		StreamBufferGuard(const StreamBufferGuard &) = delete;
+		StreamBufferGuard & operator=(const StreamBufferGuard &) = delete;
+	public:
+		explicit StreamBufferGuard(std::ios & stream)
+			: stream(stream)
+			, buffer(stream.rdbuf())
+		{}
 
-		try {
-			is >> rec;
-		} catch (Record::checksum_exception e) {
-			throw Record::checksum_exception(e, line);
+		~StreamBufferGuard()
+		{
+			stream.rdbuf(buffer);
 		}
+};
 
-		switch (rec.type()) {
-			case Record::Type::DATA:
-				for (auto i = rec.begin(); i != rec.end(); ++i) {
-					region.insert(rec.offset(), *i);
-				}
-				break;
-
-			case Record::Type::END_OF_FILE:
-				if (region.size()) {
-					data.push_back(region);
-				}
-				return;
-
-			case Record::Type::EXT_LIN_ADDRESS:
-				if (region.size()) {
-					data.push_back(region);
-				}
-				region = Region(rec.address());
-				break;
+static void print_digest(std::ostream & os, const std::string & algorithm, const std::vector<uint8_t> & digest)
+{
+	using namespace std;
 
-			default:
-				break;
-		}
+	os << "digest (" << algorithm << "): " << setbase(16) << setfill('0');
+	for (auto i = digest.begin(); i != digest.end(); ++i) {
+		os << setw(2) << static_cast<int>(*i);
 	}
+	os << setbase(10) << resetiosflags(ios::showbase) << endl;
 }
 
-static void print_info(std::ostream & os, const HexData & hex)
+static void print_info(std::ostream & os, const HexData & hex, Region::value_type fill)
 {
 	using namespace std;
 
 	Region::address_type total_size = 0;
 
 	for (auto region = hex.begin(); region != hex.end(); ++region) {
+		const Region::Statistics stat = region->statistics(fill);
 		os	<< "0x" << setbase(16) << setfill('0') << setw(8) << region->address()
 			<< "-"
 			<< "0x" << setbase(16) << setfill('0') << setw(8) << region->address() + region->size() - 1
 			<< " "
 			<< "0x" << setbase(16) << setfill('0') << setw(4) << region->size()
+			<< " fill(0x" << setw(2) << static_cast<int>(fill) << "): "
 			<< setbase(10) << resetiosflags(ios::showbase)
+			<< fixed << setprecision(1) << setfill(' ')
+			<< setw(5) << (100.0 * stat.fill / region->size()) << "%"
+			<< " longest run: " << stat.longest_run
+			<< " entropy: " << setprecision(2) << stat.entropy << " bits/byte"
 			<< endl;
 		total_size += region->size();
 	}
 	os	<< endl
 		<< "total size: " << total_size << " bytes"
 		<< endl;
+
+	if (hex.has_start_address()) {
+		const Record::address_type start = hex.start_address().address();
+		os << "entry point: " << setbase(16) << setfill('0');
+		if (hex.start_address().type() == Record::Type::START_SEG_ADDRESS) {
+			os	<< "0x" << setw(4) << (start >> 16) << ":0x" << setw(4) << (start & 0xffff)
+				<< " (CS:IP, linear 0x" << setw(8) << (((start >> 16) << 4) + (start & 0xffff)) << ")";
+		} else {
+			os << "0x" << setw(8) << start;
+		}
+		os << setbase(10) << resetiosflags(ios::showbase) << endl;
+	}
+}
+
+static void print_find(std::ostream & os, const HexData & hex,
+	const std::vector<std::pair<std::string, Pattern>> & patterns)
+{
+	using namespace std;
+
+	for (auto pattern = patterns.begin(); pattern != patterns.end(); ++pattern) {
+		auto found = hex.search(pattern->second);
+		for (auto i = found.begin(); i != found.end(); ++i) {
+			os	<< "0x" << setbase(16) << setfill('0') << setw(8) << *i
+				<< setbase(10) << resetiosflags(ios::showbase)
+				<< " : " << pattern->first
+				<< endl;
+		}
+	}
+}
+
+/// Returns the file name for a chunk: '{}' within the template is replaced
+/// by the index of the chunk, '{addr}' by its start address in hex.
+static std::string split_filename(const std::string & pattern, size_t index, Region::address_type address)
+{
+	std::ostringstream os_index;
+	os_index << index;
+	std::ostringstream os_address;
+	os_address << std::setbase(16) << std::setfill('0') << std::setw(8) << address;
+
+	std::string result = pattern;
+	for (std::string::size_type i = 0; (i = result.find("{addr}", i)) != std::string::npos; ) {
+		result.replace(i, 6, os_address.str());
+		i += os_address.str().size();
+	}
+	for (std::string::size_type i = 0; (i = result.find("{}", i)) != std::string::npos; ) {
+		result.replace(i, 2, os_index.str());
+		i += os_index.str().size();
+	}
+	return result;
+}
+
+/// Writes one chunk either as intel hex file or as binary file, in which
+/// gaps are filled with 0xFF.
+static bool split_write(const std::string & filename, const std::vector<HexData::Slice> & chunk,
+	bool binary, unsigned int width, unsigned int page_size)
+{
+	std::ofstream ofs(filename.c_str(), binary ? (std::ios::out | std::ios::binary) : std::ios::out);
+	if (!ofs) return false;
+
+	if (binary) {
+		Region::address_type address = chunk.front().address();
+		for (auto i = chunk.begin(); i != chunk.end(); ++i) {
+			if (i->address() < address) continue; // overlapping regions
+			for (; address < i->address(); ++address) ofs.put(static_cast<char>(0xff));
+			ofs.write(reinterpret_cast<const char *>(&*(i->region->begin() + i->pos)), i->size);
+			address = i->address() + i->size;
+		}
+	} else {
+		for (auto i = chunk.begin(); i != chunk.end(); ++i) {
+			i->region->dump_ihex(ofs, i->pos, i->size, width, page_size);
+		}
+		ofs << Record::eof();
+	}
+	return ofs.good();
+}
+
+/// Writes the data within each of the address ranges into its own file.
+/// The files are written concurrently, the data of the regions is not copied.
+/// Returns false if not all files could be written.
+static bool split(const HexData & hex, const std::vector<std::pair<Region::address_type, Region::address_type>> & ranges,
+	const std::string & pattern, unsigned int width, unsigned int page_size)
+{
+	using namespace std;
+
+	vector<vector<HexData::Slice>> chunks;
+	for (auto i = ranges.begin(); i != ranges.end(); ++i) {
+		auto chunk = hex.slices(i->first, i->second);
+		if (chunk.size()) chunks.push_back(chunk);
+	}
+
+	// all chunks are written concurrently, they must not share a file
+	vector<string> filenames;
+	set<string> unique;
+	for (size_t i = 0; i < chunks.size(); ++i) {
+		filenames.push_back(split_filename(pattern, i, chunks[i].front().address()));
+		if (!unique.insert(filenames.back()).second) {
+			cerr << "Error: output file name not unique, use {} or {addr} in --split-output: "
+				<< filenames.back() << endl;
+			return false;
+		}
+	}
+
+	const bool binary = (pattern.size() >= 4) && (pattern.compare(pattern.size() - 4, 4, ".bin") == 0);
+
+	vector<char> ok(chunks.size(), false);
+	atomic<size_t> next(0);
+	auto worker = [&]() {
+		for (size_t i = next++; i < chunks.size(); i = next++) {
+			ok[i] = split_write(filenames[i], chunks[i], binary, width, page_size);
+		}
+	};
+
+	const size_t n = min<size_t>(max(1u, thread::hardware_concurrency()), chunks.size());
+	vector<thread> threads;
+	for (size_t i = 1; i < n; ++i) threads.push_back(thread(worker));
+	worker();
+	for (auto i = threads.begin(); i != threads.end(); ++i) i->join();
+
+	bool result = true;
+	for (size_t i = 0; i < chunks.size(); ++i) {
+		if (ok[i]) continue;
+		cerr << "Error: cannot write output file: " << filenames[i] << endl;
+		result = false;
+	}
+	return result;
+}
+
+/// Maps the ELF file into memory and reads its loadable segments.
+/// Returns false if the file cannot be opened or mapped, errors within the
+/// file are thrown as HexData::elf_exception.
+static bool read_elf_file(const std::string & filename, HexData & hex)
+{
+	const int fd = open(filename.c_str(), O_RDONLY);
+	if (fd < 0) return false;
+
+	struct stat st;
+	if (fstat(fd, &st) < 0 || st.st_size <= 0) {
+		close(fd);
+		return false;
+	}
+	const size_t size = static_cast<size_t>(st.st_size);
+
+	void * p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) return false;
+
+	try {
+		hex.read_elf(static_cast<const uint8_t *>(p), size);
+	} catch (...) {
+		munmap(p, size);
+		throw;
+	}
+	munmap(p, size);
+	return true;
 }
 
 static struct Options {
@@ -605,7 +773,34 @@ static struct Options {
 	std::string output_filename;
 	std::set<Region::address_type> erase_region;
 	std::set<std::pair<Region::address_type, Region::address_type>> move_region;
-} options = { false, false, false, false, false, 16, 32, "", "", {}, {} };
+	std::vector<std::pair<std::string, Pattern>> find;
+	bool trim;
+	unsigned int trim_fill;
+	unsigned int trim_threshold;
+	unsigned int page_size;
+	bool page_pad;
+	unsigned int page_fill;
+	std::string digest;
+	bool digest_fill;
+	unsigned int digest_fill_value;
+	bool digest_range;
+	Region::address_type digest_first;
+	Region::address_type digest_last;
+	bool digest_write;
+	Region::address_type digest_address;
+	bool split;
+	bool split_region;
+	uint64_t split_size;
+	std::vector<std::pair<Region::address_type, Region::address_type>> split_ranges;
+	std::string split_output;
+	bool stream;
+	std::string elf_input_filename;
+} options = {
+	false, false, false, false, false, 16, 32, "", "", {}, {}, {}, false, 0xff, 16, 0, false, 0xff,
+	"", false, 0xff, false, 0x00000000, 0xffffffff, false, 0,
+	false, false, 0, {}, "chunk-{}.hex",
+	false, ""
+};
 
 enum Option : int {
 	 HELP = 0
@@ -617,6 +812,20 @@ enum Option : int {
 	,INFO
 	,MOVE_REGION
 	,VERSION
+	,FIND
+	,FIND_STRING
+	,TRIM
+	,TRIM_THRESHOLD
+	,PAGE_SIZE
+	,PAGE_FILL
+	,DIGEST
+	,DIGEST_FILL
+	,DIGEST_RANGE
+	,DIGEST_ADDRESS
+	,SPLIT
+	,SPLIT_OUTPUT
+	,STREAM
+	,ELF_INPUT
 };
 
 static const struct option LONG_OPTIONS[] =
@@ -630,6 +839,20 @@ static const struct option LONG_OPTIONS[] =
 	{ "info",         no_argument,       NULL, Option::INFO         },
 	{ "move-region",  required_argument, NULL, Option::MOVE_REGION  },
 	{ "version",      no_argument,       NULL, Option::VERSION      },
+	{ "find",         required_argument, NULL, Option::FIND         },
+	{ "find-string",  required_argument, NULL, Option::FIND_STRING  },
+	{ "trim",         optional_argument, NULL, Option::TRIM         },
+	{ "trim-threshold", required_argument, NULL, Option::TRIM_THRESHOLD },
+	{ "page-size",    required_argument, NULL, Option::PAGE_SIZE    },
+	{ "page-fill",    optional_argument, NULL, Option::PAGE_FILL    },
+	{ "digest",       optional_argument, NULL, Option::DIGEST       },
+	{ "digest-fill",  optional_argument, NULL, Option::DIGEST_FILL  },
+	{ "digest-range", required_argument, NULL, Option::DIGEST_RANGE },
+	{ "digest-address", required_argument, NULL, Option::DIGEST_ADDRESS },
+	{ "split",        required_argument, NULL, Option::SPLIT        },
+	{ "split-output", required_argument, NULL, Option::SPLIT_OUTPUT },
+	{ "stream",       no_argument,       NULL, Option::STREAM       },
+	{ "elf-input",    required_argument, NULL, Option::ELF_INPUT    },
 };
 
 static void print_version(void)
@@ -661,7 +884,10 @@ static void usage(const char * name)
 	cout << "\t" << "--version                     : prints the version of the program" << endl;
 	cout << "\t" << "--info                        : shows general information about the hex file" << endl;
 	cout << "\t" << "--input filename              : input file name, intel hex 8bit format" << endl;
-	cout << "\t" << "--output filename             : output file name" << endl;
+	cout << "\t" << "                                compressed if ending in '.gz' or '.zst'" << endl;
+	cout << "\t" << "--elf-input filename          : input file name, ELF file, the loadable segments are" << endl;
+	cout << "\t" << "                                read at their physical addresses" << endl;
+	cout << "\t" << "--output filename             : output file name, compressed if ending in '.gz' or '.zst'" << endl;
 	cout << "\t" << "--dump [=width]               : output file as hex dump, width of the" << endl;
 	cout << "\t" << "                                output [4..64], default:16" << endl;
 	cout << "\t" << "--ihex [=width]               : output file as intel 8bit hex file, width of" << endl;
@@ -674,6 +900,39 @@ static void usage(const char * name)
 	cout << "\t" << "                                specifying overlapping moves result in an undefined behaviour" << endl;
 	cout << "\t" << "                                NOTE: not all overlapping/overwriting possibilities" << endl;
 	cout << "\t" << "                                are being checked, be careful!" << endl;
+	cout << "\t" << "--find bytes[/mask]           : searches all regions for the byte pattern, bytes in hex" << endl;
+	cout << "\t" << "                                (e.g. 'DEADBEEF'), the optional mask selects the bits" << endl;
+	cout << "\t" << "                                to compare (e.g. 'DEADBEEF/FFFF00FF')" << endl;
+	cout << "\t" << "                                this parameter may be specified multiple times" << endl;
+	cout << "\t" << "--find-string text            : searches all regions for the text" << endl;
+	cout << "\t" << "                                this parameter may be specified multiple times" << endl;
+	cout << "\t" << "--trim [=fill]                : drops runs of the fill byte (erased flash, padding)" << endl;
+	cout << "\t" << "                                and splits the regions accordingly, fill in hex," << endl;
+	cout << "\t" << "                                default:FF. also used as fill byte for --info statistics" << endl;
+	cout << "\t" << "--trim-threshold length       : only runs longer than this are dropped, default:16" << endl;
+	cout << "\t" << "--page-size size              : flash page size (power of two, max. 0x10000), records" << endl;
+	cout << "\t" << "                                written by --ihex are aligned and never cross a page" << endl;
+	cout << "\t" << "--page-fill [=fill]           : pads partial pages with the fill byte, default:FF" << endl;
+	cout << "\t" << "                                regions sharing a page are merged, requires --page-size" << endl;
+	cout << "\t" << "--digest [=algorithm]         : digest of the memory image (regions in address order)," << endl;
+	cout << "\t" << "                                algorithm: sha256, blake3, default:sha256" << endl;
+	cout << "\t" << "                                shown by --info, or alone if no other output is requested" << endl;
+	cout << "\t" << "--digest-fill [=fill]         : fills gaps between regions for the digest, default:FF" << endl;
+	cout << "\t" << "                                with --digest-range the entire window is filled" << endl;
+	cout << "\t" << "--digest-range address-address: restricts the digest to the address window (inclusive)" << endl;
+	cout << "\t" << "--digest-address address      : writes the digest into the image at the address," << endl;
+	cout << "\t" << "                                which should be outside of the digest range" << endl;
+	cout << "\t" << "--split mode                  : writes the data into multiple files, mode is one of:" << endl;
+	cout << "\t" << "                                size:N    chunks of N bytes, starting at the lowest address" << endl;
+	cout << "\t" << "                                region    one file per region" << endl;
+	cout << "\t" << "                                a-b[,c-d] one file per address range (hex, inclusive)" << endl;
+	cout << "\t" << "--split-output template       : file name template for --split, default:chunk-{}.hex" << endl;
+	cout << "\t" << "                                '{}' is replaced by the chunk index, '{addr}' by its" << endl;
+	cout << "\t" << "                                address, files ending in '.bin' are written as binary" << endl;
+	cout << "\t" << "--stream                      : pipelined --ihex output, for use within pipes. Output is" << endl;
+	cout << "\t" << "                                written per region (up to 64kB) as soon as it is complete," << endl;
+	cout << "\t" << "                                not per input record. Only --ihex and" << endl;
+	cout << "\t" << "                                --page-size are supported in this mode" << endl;
 	cout << endl;
 }
 
@@ -696,6 +955,85 @@ static void move_region_append(const char * optarg)
 		std::pair<Region::address_type, Region::address_type>(src, dst));
 }
 
+static uint8_t hex_digit(char c)
+{
+	return isdigit(c) ? (c - '0') : (toupper(c) - 'A' + 10);
+}
+
+static bool parse_hex_bytes(const std::string & s, Pattern::Data & bytes)
+{
+	std::string::size_type i = 0;
+	if (s.size() >= 2 && s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) i = 2;
+	if ((s.size() - i) % 2) return false;
+	for (; i < s.size(); i += 2) {
+		if (!isxdigit(s[i]) || !isxdigit(s[i + 1])) return false;
+		bytes.push_back((hex_digit(s[i]) << 4) | hex_digit(s[i + 1]));
+	}
+	return true;
+}
+
+static bool find_append(const char * optarg)
+{
+	const std::string s = optarg;
+	const std::string::size_type slash = s.find('/');
+
+	Pattern::Data bytes;
+	Pattern::Data mask;
+	if (!parse_hex_bytes(s.substr(0, slash), bytes) || bytes.empty()) {
+		std::cerr << "Error: invalid search pattern: " << s << std::endl;
+		return false;
+	}
+	if (slash != std::string::npos) {
+		if (!parse_hex_bytes(s.substr(slash + 1), mask) || mask.size() != bytes.size()) {
+			std::cerr << "Error: invalid search mask: " << s << std::endl;
+			return false;
+		}
+	}
+	options.find.push_back(std::make_pair(s, Pattern(bytes, mask)));
+	return true;
+}
+
+static bool find_string_append(const char * optarg)
+{
+	const std::string s = optarg;
+	if (s.empty()) {
+		std::cerr << "Error: empty search string" << std::endl;
+		return false;
+	}
+	options.find.push_back(std::make_pair("\"" + s + "\"", Pattern(Pattern::Data(s.begin(), s.end()))));
+	return true;
+}
+
+static bool split_parse(const char * optarg)
+{
+	const std::string s = optarg;
+
+	options.split = true;
+	if (s == "region") {
+		options.split_region = true;
+		return true;
+	}
+	if (s.compare(0, 5, "size:") == 0) {
+		std::istringstream(s.substr(5)) >> std::setbase(0) >> options.split_size;
+		if (options.split_size) return true;
+	} else {
+		std::istringstream is(s);
+		while (is) {
+			Region::address_type first = 0;
+			Region::address_type last = 0;
+			char minus = 0;
+			is >> std::hex >> first >> minus >> last;
+			if (!is || minus != '-' || first > last) break;
+			options.split_ranges.push_back(std::make_pair(first, last));
+			char comma = 0;
+			if (!(is >> comma)) return true;
+			if (comma != ',') break;
+		}
+	}
+	std::cerr << "Error: invalid split mode: " << s << std::endl;
+	return false;
+}
+
 static int parse_options(int argc, char ** argv)
 {
 	while (optind < argc) {
@@ -750,6 +1088,96 @@ static int parse_options(int argc, char ** argv)
 				options.version = true;
 				break;
 
+			case Option::FIND:
+				if (!find_append(optarg)) return -1;
+				break;
+
+			case Option::FIND_STRING:
+				if (!find_string_append(optarg)) return -1;
+				break;
+
+			case Option::TRIM:
+				options.trim = true;
+				if (optarg) {
+					std::istringstream(optarg) >> std::hex >> options.trim_fill;
+					options.trim_fill &= 0xff;
+				}
+				break;
+
+			case Option::TRIM_THRESHOLD:
+				std::istringstream(optarg) >> options.trim_threshold;
+				break;
+
+			case Option::PAGE_SIZE:
+				std::istringstream(optarg) >> std::setbase(0) >> options.page_size;
+				if (!options.page_size || (options.page_size & (options.page_size - 1))
+					|| options.page_size > 0x10000) {
+					std::cerr << "Error: invalid page size: " << optarg << std::endl;
+					return -1;
+				}
+				break;
+
+			case Option::PAGE_FILL:
+				options.page_pad = true;
+				if (optarg) {
+					std::istringstream(optarg) >> std::hex >> options.page_fill;
+					options.page_fill &= 0xff;
+				}
+				break;
+
+			case Option::DIGEST:
+				options.digest = optarg ? optarg : "sha256";
+				if (options.digest != "sha256" && options.digest != "blake3") {
+					std::cerr << "Error: unknown digest algorithm: " << options.digest << std::endl;
+					return -1;
+				}
+				break;
+
+			case Option::DIGEST_FILL:
+				options.digest_fill = true;
+				if (optarg) {
+					std::istringstream(optarg) >> std::hex >> options.digest_fill_value;
+					options.digest_fill_value &= 0xff;
+				}
+				break;
+
+			case Option::DIGEST_RANGE:
+				{
+					char minus = 0;
+					options.digest_range = true;
+					std::istringstream is(optarg);
+					is >> std::hex >> options.digest_first >> minus >> options.digest_last;
+					if (!is || minus != '-' || !(is >> std::ws).eof() || options.digest_first > options.digest_last) {
+						std::cerr << "Error: invalid digest range: " << optarg << std::endl;
+						return -1;
+					}
+				}
+				break;
+
+			case Option::DIGEST_ADDRESS:
+				options.digest_write = true;
+				if (!(std::istringstream(optarg) >> std::hex >> options.digest_address)) {
+					std::cerr << "Error: invalid digest address: " << optarg << std::endl;
+					return -1;
+				}
+				break;
+
+			case Option::SPLIT:
+				if (!split_parse(optarg)) return -1;
+				break;
+
+			case Option::SPLIT_OUTPUT:
+				options.split_output = optarg;
+				break;
+
+			case Option::STREAM:
+				options.stream = true;
+				break;
+
+			case Option::ELF_INPUT:
+				options.elf_input_filename = optarg;
+				break;
+
 			default:
 				return -1;
 		}
@@ -781,30 +1209,65 @@ int main(int argc, char ** argv)
 		return 0;
 	}
 
+	if (options.elf_input_filename.size() && (options.input_filename.size() || options.stream)) {
+		cerr << "Error: --elf-input cannot be combined with --input or --stream" << endl;
+		return -1;
+	}
+
+	if (options.stream) {
+		if (!options.ihex || options.info || options.dump || options.find.size() || options.split
+			|| options.erase_region.size() || options.move_region.size() || options.trim
+			|| options.page_pad || options.digest.size()) {
+			cerr << "Error: --stream supports only --ihex output without modifications" << endl;
+			return -1;
+		}
+		ios::sync_with_stdio(false);
+	}
+
 	// handle input
 
 	ifstream ifs;
-	streambuf * cin_old = cin.rdbuf();
+	unique_ptr<FilterBuffer> input_filter;
+	StreamBufferGuard cin_guard(cin);
 	if (options.input_filename.size()) {
-		ifs.open(options.input_filename.c_str(), ios::in);
+		const Compression type = compression(options.input_filename);
+		ifs.open(options.input_filename.c_str(), (type == Compression::NONE) ? ios::in : (ios::in | ios::binary));
 		if (!ifs) {
 			cerr << "Error: cannot open input file: " << options.input_filename << endl;
 			return -2;
 		}
 		cin.rdbuf(ifs.rdbuf());
+		if (type != Compression::NONE) {
+			input_filter = create_input_filter(type, ifs.rdbuf());
+			if (!input_filter) {
+				cerr << "Error: compression not supported: " << options.input_filename << endl;
+				return -2;
+			}
+			cin.rdbuf(input_filter.get());
+		}
 	}
 
 	// handle output
 
 	ofstream ofs;
-	streambuf * cout_old = cout.rdbuf();
+	unique_ptr<FilterBuffer> output_filter;
+	StreamBufferGuard cout_guard(cout);
 	if (options.output_filename.size()) {
-		ofs.open(options.output_filename.c_str(), ios::out);
+		const Compression type = compression(options.output_filename);
+		ofs.open(options.output_filename.c_str(), (type == Compression::NONE) ? ios::out : (ios::out | ios::binary));
 		if (!ofs) {
 			cerr << "Error: cannot open output file: " << options.output_filename << endl;
 			return -2;
 		}
 		cout.rdbuf(ofs.rdbuf());
+		if (type != Compression::NONE) {
+			output_filter = create_output_filter(type, ofs.rdbuf());
+			if (!output_filter) {
+				cerr << "Error: compression not supported: " << options.output_filename << endl;
+				return -2;
+			}
+			cout.rdbuf(output_filter.get());
+		}
 	}
 
 	// read data
@@ -812,8 +1275,17 @@ int main(int argc, char ** argv)
 	HexData hex;
 
 	try {
-		hex.read_records(cin);
-	} catch (Record::checksum_exception e) {
+		if (options.stream) {
+			stream_ihex(cin, cout, options.ihex_width, options.page_size);
+		} else if (options.elf_input_filename.size()) {
+			if (!read_elf_file(options.elf_input_filename, hex)) {
+				cerr << "Error: cannot open input file: " << options.elf_input_filename << endl;
+				return -2;
+			}
+		} else {
+			hex.read_records(cin);
+		}
+	} catch (const Record::checksum_exception & e) {
 		cerr
 			<< setbase(10) << resetiosflags(ios::showbase)
 			<< "ERROR: " << argv[0] << ": record checksum error on line " << e.line << " : "
@@ -823,16 +1295,36 @@ int main(int argc, char ** argv)
 			<< "0x" << setfill('0') << setw(2) << static_cast<int>(e.calculated)
 			<< endl;
 		return -1;
-	} catch (Record::unknown_type_exception) {
+	} catch (const Record::unknown_type_exception &) {
 		cerr
 			<< "ERROR: " << argv[0] << ": unknown record type"
 			<< endl;
 		return -1;
-	} catch (Region::continuous_exception) {
+	} catch (const Region::continuous_exception &) {
 		cerr
 			<< "ERROR: " << argv[0] << ": region does not contain continuous data, not supported"
 			<< endl;
 		return -1;
+	} catch (const HexData::elf_exception & e) {
+		cerr
+			<< "ERROR: " << argv[0] << ": " << e.what()
+			<< endl;
+		return -1;
+	}
+
+	if (input_filter && input_filter->fail()) {
+		cerr
+			<< "ERROR: " << argv[0] << ": corrupt compressed input"
+			<< endl;
+		return -1;
+	}
+
+	if (options.stream) {
+		if (!finish_output(cout, output_filter.get())) {
+			cerr << "Error: cannot write output file: " << options.output_filename << endl;
+			return -2;
+		}
+		return 0;
 	}
 
 	// manipulate data
@@ -878,18 +1370,101 @@ int main(int argc, char ** argv)
 		}
 	}
 
+	if (options.trim) {
+		hex.trim(options.trim_fill, options.trim_threshold);
+	}
+
+	if (options.page_pad) {
+		if (!options.page_size) {
+			cerr << "Error: --page-fill requires --page-size" << endl;
+			return -1;
+		}
+		hex.pad(options.page_size, options.page_fill);
+	}
+
+	vector<uint8_t> digest;
+	if (options.digest.size()) {
+		if (options.digest == "blake3") {
+			// BLAKE3 hashes subtrees concurrently, the image must be in memory
+			vector<uint8_t> image;
+			try {
+				image = options.digest_range
+					? hex.image(options.digest_first, options.digest_last, options.digest_fill, options.digest_fill_value)
+					: hex.image(options.digest_fill, options.digest_fill_value);
+			} catch (std::bad_alloc &) {
+				cerr << "Error: not enough memory for the digest image" << endl;
+				return -2;
+			}
+			digest = Blake3::hash(image.data(), image.size(), max(1u, thread::hardware_concurrency()));
+		} else {
+			Sha256 sha;
+			auto update = [&sha](const uint8_t * p, size_t n) { sha.update(p, n); };
+			if (options.digest_range) {
+				hex.image(options.digest_first, options.digest_last, options.digest_fill, options.digest_fill_value, update);
+			} else {
+				hex.image(options.digest_fill, options.digest_fill_value, update);
+			}
+			digest = sha.digest();
+		}
+		if (options.digest_write && !hex.write(options.digest_address, digest.begin(), digest.end())) {
+			cerr
+				<< "warning: digest at address "
+				<< "0x" << setbase(16) << setfill('0') << setw(8) << options.digest_address
+				<< setbase(10) << resetiosflags(ios::showbase)
+				<< " not entirely within a region or crossing a 64kB boundary"
+				<< endl;
+		}
+	}
+
 	// output results
 
 	if (options.info) {
-		print_info(cout, hex);
+		print_info(cout, hex, options.trim_fill);
+		if (digest.size()) print_digest(cout, options.digest, digest);
+	} else if (options.find.size()) {
+		print_find(cout, hex, options.find);
+	} else if (options.split) {
+		auto ranges = options.split_ranges;
+		if (options.split_region || options.split_size) {
+			vector<const Region *> regions;
+			for (auto i = hex.begin(); i != hex.end(); ++i) {
+				if (i->size()) regions.push_back(&*i);
+			}
+			sort(regions.begin(), regions.end(),
+				[](const Region * a, const Region * b) { return a->address() < b->address(); });
+
+			if (options.split_region) {
+				for (auto i = regions.begin(); i != regions.end(); ++i) {
+					ranges.push_back(make_pair((*i)->address(), (*i)->address() + ((*i)->size() - 1)));
+				}
+			} else if (regions.size()) {
+				// chunks without data are skipped
+				const uint64_t first = regions.front()->address();
+				const uint64_t size = options.split_size;
+				uint64_t a = first;
+				for (auto i = regions.begin(); i != regions.end(); ++i) {
+					const uint64_t last = (*i)->address() + ((*i)->size() - 1);
+					if (last < a) continue;
+					a = max(a, first + ((*i)->address() - first) / size * size);
+					for (; a <= last; a += size) {
+						ranges.push_back(make_pair(a, min<uint64_t>(a + size - 1, 0xffffffff)));
+					}
+				}
+			}
+		}
+		if (!split(hex, ranges, options.split_output, options.ihex_width, options.page_size)) return -2;
 	} else if (options.dump) {
 		hex.dump_data(cout, options.dump_width);
 	} else if (options.ihex) {
-		hex.dump_ihex(cout, options.ihex_width);
+		hex.dump_ihex(cout, options.ihex_width, options.page_size);
+	} else if (digest.size() && !options.digest_write) {
+		print_digest(cout, options.digest, digest);
 	}
 
-	cin.rdbuf(cin_old);
-	cout.rdbuf(cout_old);
+	if (!finish_output(cout, output_filter.get())) {
+		cerr << "Error: cannot write output file: " << options.output_filename << endl;
+		return -2;
+	}
 
 	return 0;
 }
@@ -0,0 +1,1235 @@
+// libihex.cpp
+// (c) 2015 Mario Konrad <mario.konrad@gmx.net>
+//
+// this software is distributed under the license: GPLv2 (http://www.gnu.org/licenses/gpl-2.0.html)
+
+#include "libihex.hpp"
+#include "libihex.h"
+#include <iostream>
+#include <iomanip>
+#include <memory>
+#include <new>
+#include <cmath>
+#include <thread>
+#include <ctype.h>
+#include <string.h>
+#include <elf.h>
+
+namespace ihex
+{
+
+static inline uint8_t h2b(char h)
+{
+	if (h >= '0' && h <= '9') return h-'0';
+	if (h >= 'A' && h <= 'F') return h-'A'+10;
+	if (h >= 'a' && h <= 'f') return h-'a'+10;
+	return 0x00;
+}
+
+Record Record::create_data(address_type address)
+{
+	Record rec(Type::DATA);
+	rec.off = address & 0xffff;
+	return rec;
+}
+
+Record Record::start_linear(address_type address)
+{
+	Record rec(Type::START_LIN_ADDRESS);
+	rec.bytes.reserve(4);
+	rec.bytes.push_back((address >> 24) & 0xff);
+	rec.bytes.push_back((address >> 16) & 0xff);
+	rec.bytes.push_back((address >>  8) & 0xff);
+	rec.bytes.push_back((address >>  0) & 0xff);
+	return rec;
+}
+
+Record Record::eof(void)
+{
+	return Record(Type::END_OF_FILE);
+}
+
+Record::Record(void)
+	: off(0)
+	, t(Type::END_OF_FILE)
+{}
+
+Record::Record(Type type)
+	: off(0)
+	, t(type)
+{}
+
+Record::Record(address_type address)
+	: off(0)
+	, t(Type::EXT_LIN_ADDRESS)
+{
+	bytes.reserve(2);
+	bytes.push_back((address >> 24) & 0xff);
+	bytes.push_back((address >> 16) & 0xff);
+}
+
+/// Returns the address of an address record: the linear base address of
+/// extended segment and linear address records, the start address (CS:IP
+/// or EIP) of start address records.
+Record::address_type Record::address(void) const
+{
+	address_type address = 0;
+	switch (t) {
+		case Type::EXT_SEG_ADDRESS:
+			if (bytes.size() < 2) return 0;
+			address = (bytes[0] << 8) | bytes[1];
+			return address << 4;
+
+		case Type::START_SEG_ADDRESS:
+		case Type::START_LIN_ADDRESS:
+			if (bytes.size() < 4) return 0;
+			for (int i = 0; i < 4; ++i) {
+				address <<= 8;
+				address += bytes[i];
+			}
+			return address;
+
+		default:
+			break;
+	}
+
+	if (bytes.size() < 2) return 0;
+	address += bytes[0];
+	address <<= 8;
+	address += bytes[1];
+	address <<= 16;
+	return address;
+}
+
+Record::const_iterator Record::begin(void) const
+{
+	return bytes.begin();
+}
+
+Record::const_iterator Record::end(void) const
+{
+	return bytes.end();
+}
+
+Record::size_type Record::size(void) const
+{
+	return bytes.size();
+}
+
+Record::Type Record::type(void) const
+{
+	return t;
+}
+
+Record::offset_type Record::offset(void) const
+{
+	return off;
+}
+
+void Record::push_back(value_type val)
+{
+	bytes.push_back(val);
+}
+
+Record::checksum_type Record::checksum(void) const
+{
+	checksum_type sum = 0;
+	sum += static_cast<checksum_type>(bytes.size());
+	sum += (off >> 8) & 0xff;
+	sum += (off >> 0) & 0xff;
+	sum += static_cast<uint16_t>(type());
+	for (auto i = bytes.begin(); i != bytes.end(); ++i) {
+		sum += *i;
+	}
+	return -sum;
+}
+
+/// Parses one record from the text, whitespace is ignored.
+Record Record::parse(const char * p, size_t n)
+{
+	const char * last = p + n;
+	auto next = [&p, last](void) -> char {
+		while (p != last && isspace(static_cast<unsigned char>(*p))) ++p;
+		return (p != last) ? *p++ : '0';
+	};
+	auto byte = [&next](void) -> value_type {
+		const value_type hi = h2b(next());
+		return (hi << 4) | h2b(next());
+	};
+
+	next(); // consume leading colon ':'
+
+	Record rec;
+	const value_type len = byte();
+	rec.off = byte() << 8;
+	rec.off |= byte();
+
+	const Type type = static_cast<Type>(byte());
+	switch (type) {
+		case Type::DATA:
+		case Type::END_OF_FILE:
+		case Type::EXT_SEG_ADDRESS:
+		case Type::START_SEG_ADDRESS:
+		case Type::EXT_LIN_ADDRESS:
+		case Type::START_LIN_ADDRESS:
+			break;
+		default:
+			throw unknown_type_exception(type);
+	}
+	rec.t = type;
+
+	rec.bytes.reserve(len);
+	for (value_type i = 0; i < len; ++i) {
+		rec.bytes.push_back(byte());
+	}
+	const checksum_type checksum = byte();
+
+	if (checksum != rec.checksum()) throw checksum_exception(checksum, rec.checksum());
+
+	return rec;
+}
+
+/// Writes the record as text, including the newline, to the buffer, which
+/// must provide space for at least MAX_ENCODED_SIZE characters. Returns the
+/// number of characters written.
+size_t Record::encode(char * p) const
+{
+	static const char HEX[] = "0123456789ABCDEF";
+
+	char * q = p;
+	auto put = [&q](value_type value) {
+		*q++ = HEX[value >> 4];
+		*q++ = HEX[value & 0x0f];
+	};
+
+	*q++ = ':';
+	put(static_cast<value_type>(bytes.size()));
+	put(off >> 8);
+	put(off & 0xff);
+	put(t);
+	for (auto i = bytes.begin(); i != bytes.end(); ++i) {
+		put(*i);
+	}
+	put(checksum());
+	*q++ = '\n';
+	return q - p;
+}
+
+std::istream & operator >> (std::istream & is, Record & rec)
+{
+	std::string line;
+	getline(is, line);
+	rec = Record::parse(line.data(), line.size());
+	return is;
+}
+
+std::ostream & operator << (std::ostream & os, const Record & rec)
+{
+	char buf[Record::MAX_ENCODED_SIZE];
+	const size_t n = rec.encode(buf);
+	os.write(buf, n - 1);
+	os << std::endl;
+	return os;
+}
+
+/// Returns a pointer to the first byte in [first, last) which is not equal
+/// to the specified value, or last if there is none. Compares word-wise to
+/// skip long runs quickly.
+static const uint8_t * find_not(const uint8_t * first, const uint8_t * last, uint8_t value)
+{
+	const uint64_t pattern = 0x0101010101010101ull * value;
+	while (last - first >= 8) {
+		uint64_t word;
+		memcpy(&word, first, sizeof(word));
+		if (word != pattern) break;
+		first += 8;
+	}
+	while (first != last && *first == value) ++first;
+	return first;
+}
+
+/// Creates a region at the specified address, filled with the value.
+Region Region::create(address_type address, size_type size, value_type fill)
+{
+	Region region(address & 0xffff0000);
+	region.offset = address & 0x0000ffff;
+	region.offset_already_set = true;
+	region.data.assign(size, fill);
+	return region;
+}
+
+/// Creates a region at the specified address, containing a copy of the data.
+Region Region::create(address_type address, const value_type * p, size_type size)
+{
+	Region region(address & 0xffff0000);
+	region.offset = address & 0x0000ffff;
+	region.offset_already_set = true;
+	region.data.assign(p, p + size);
+	return region;
+}
+
+Region::Region(address_type base_address)
+	: base_address(base_address)
+	, offset(0)
+	, offset_already_set(false)
+{}
+
+Region::address_type Region::address(void) const
+{
+	return base_address + offset;
+}
+
+void Region::move_base_address(address_type destination_base_address)
+{
+	base_address = destination_base_address & 0xffff0000;
+	offset = destination_base_address & 0x0000ffff;
+}
+
+bool Region::inside(address_type address) const
+{
+	return true
+		&& (address >= base_address + offset)
+		&& (address < base_address + offset - size())
+		;
+}
+
+/// Overwrites the data at the specified address, data outside of the region
+/// is ignored.
+void Region::write(address_type address, const_iterator first, const_iterator last)
+{
+	for (; first != last; ++first, ++address) {
+		if (address >= this->address() && address - this->address() < data.size()) {
+			data[address - this->address()] = *first;
+		}
+	}
+}
+
+/// Returns a new region containing the specified part of this region.
+Region Region::slice(size_type pos, size_type n) const
+{
+	const address_type address = this->address() + pos;
+
+	Region region(address & 0xffff0000);
+	region.offset = address & 0x0000ffff;
+	region.offset_already_set = true;
+	region.data.assign(data.begin() + pos, data.begin() + pos + n);
+	return region;
+}
+
+/// Splits the region into parts which do not contain runs of the fill value
+/// longer than the threshold. The runs themselves are dropped.
+std::vector<Region> Region::trim(value_type fill, size_type threshold) const
+{
+	std::vector<Region> result;
+
+	const value_type * first = data.data();
+	const value_type * last = first + data.size();
+	const value_type * start = first; // start of the current part to keep
+
+	for (const value_type * p = first; p != last;) {
+		const value_type * run = static_cast<const value_type *>(memchr(p, fill, last - p));
+		if (!run) break;
+		p = find_not(run, last, fill);
+		if (static_cast<size_type>(p - run) > threshold) {
+			if (run != start) result.push_back(slice(start - first, run - start));
+			start = p;
+		}
+	}
+	if (start != last) result.push_back(slice(start - first, last - start));
+	return result;
+}
+
+Region::Statistics Region::statistics(value_type fill) const
+{
+	Statistics stat = { 0, 0, 0.0 };
+
+	size_type histogram[256] = { 0 };
+	for (auto i = data.begin(); i != data.end(); ++i) ++histogram[*i];
+	stat.fill = histogram[fill];
+
+	for (size_type i = 0; i < 256; ++i) {
+		if (!histogram[i]) continue;
+		const double p = static_cast<double>(histogram[i]) / data.size();
+		stat.entropy -= p * std::log2(p);
+	}
+
+	const value_type * last = data.data() + data.size();
+	for (const value_type * p = data.data(); p != last;) {
+		const value_type * run = static_cast<const value_type *>(memchr(p, fill, last - p));
+		if (!run) break;
+		p = find_not(run, last, fill);
+		stat.longest_run = std::max(stat.longest_run, static_cast<size_type>(p - run));
+	}
+	return stat;
+}
+
+void Region::insert(offset_type value_offset, value_type value)
+{
+	if (offset_already_set) {
+		if (value_offset < offset) throw continuous_exception();
+		if (value_offset > data.size() + offset) throw continuous_exception();
+	} else {
+		offset = value_offset;
+		offset_already_set = true;
+	}
+	data.push_back(value);
+}
+
+Region::size_type Region::size(void) const
+{
+	return data.size();
+}
+
+Region::const_iterator Region::begin(void) const
+{
+	return data.begin();
+}
+
+Region::const_iterator Region::end(void) const
+{
+	return data.end();
+}
+
+const Region::value_type * Region::bytes(void) const
+{
+	return data.data();
+}
+
+void Region::dump_data(std::ostream & os, unsigned int width) const
+{
+	size_type count = 0;
+	address_type address = base_address + offset;
+
+	os << std::setbase(16) << std::resetiosflags(std::ios::showbase);
+	for (auto i = data.begin(); i != data.end(); ++i, ++address) {
+		if (count >= width) {
+			count = 0;
+			os << std::endl;
+		}
+		if (count == 0) {
+			os << "0x" << std::setfill('0') << std::setw(8) << address << " :";
+		}
+		os << " " << std::setfill('0') << std::setw(2) << static_cast<int>(*i);
+		++count;
+	}
+	os << std::endl;
+}
+
+/// Writes the region as intel hex records. If a page size is specified,
+/// records are aligned to multiples of the width and never cross a page
+/// boundary.
+void Region::dump_ihex(std::ostream & os, unsigned int width, unsigned int page_size) const
+{
+	dump_ihex(os, 0, data.size(), width, page_size);
+}
+
+/// Writes the specified part of the region as intel hex records.
+void Region::dump_ihex(std::ostream & os, size_type pos, size_type n, unsigned int width, unsigned int page_size) const
+{
+	records(pos, n, width, page_size, [&os](const Record & rec) { os << rec; });
+}
+
+Pattern::Pattern(void)
+{}
+
+Pattern::Pattern(const Data & bytes, const Data & mask)
+	: bytes(bytes)
+	, mask(mask)
+{
+	if (this->mask.size() > this->bytes.size()) this->mask.resize(this->bytes.size());
+	if (this->mask.size()) this->mask.resize(this->bytes.size(), 0xff);
+	if (std::find_if(this->mask.begin(), this->mask.end(), [](value_type m) { return m != 0xff; }) == this->mask.end()) {
+		this->mask.clear();
+	}
+	for (size_type i = 0; i < this->mask.size(); ++i) {
+		this->bytes[i] &= this->mask[i];
+	}
+}
+
+Pattern::size_type Pattern::size(void) const
+{
+	return bytes.size();
+}
+
+bool Pattern::match(const value_type * p) const
+{
+	if (mask.empty()) return memcmp(p, bytes.data(), bytes.size()) == 0;
+	for (size_type i = 0; i < bytes.size(); ++i) {
+		if ((p[i] & mask[i]) != bytes[i]) return false;
+	}
+	return true;
+}
+
+/// Searches the buffer for all (possibly overlapping) occurrences of the pattern
+/// and appends the absolute addresses of the matches. The buffer is located at
+/// the specified address.
+///
+/// Long exact patterns are searched using Boyer-Moore-Horspool, all others
+/// are filtered by one anchor byte with memchr (vectorized by the C library)
+/// and verified afterwards.
+void Pattern::search(const value_type * buf, size_type n, Record::address_type address, std::vector<Record::address_type> & result) const
+{
+	if (bytes.empty() || n < bytes.size()) return;
+	if (mask.empty() && bytes.size() >= 16) {
+		search_horspool(buf, n, address, result);
+	} else {
+		search_anchor(buf, n, address, result);
+	}
+}
+
+void Pattern::search_anchor(const value_type * buf, size_type n, Record::address_type address, std::vector<Record::address_type> & result) const
+{
+	// the anchor is the first byte of the pattern which has to match exactly
+	size_type anchor = 0;
+	if (mask.size()) {
+		while (anchor < mask.size() && mask[anchor] != 0xff) ++anchor;
+		if (anchor == mask.size()) {
+			for (size_type i = 0; i + bytes.size() <= n; ++i) {
+				if (match(buf + i)) result.push_back(address + i);
+			}
+			return;
+		}
+	}
+
+	const value_type * p = buf + anchor;
+	const value_type * last = buf + (n - bytes.size()) + anchor; // last possible anchor position
+	while (p <= last) {
+		p = static_cast<const value_type *>(memchr(p, bytes[anchor], last - p + 1));
+		if (!p) break;
+		if (match(p - anchor)) result.push_back(address + (p - anchor - buf));
+		++p;
+	}
+}
+
+void Pattern::search_horspool(const value_type * buf, size_type n, Record::address_type address, std::vector<Record::address_type> & result) const
+{
+	const size_type m = bytes.size();
+	size_type shift[256];
+	for (size_type i = 0; i < 256; ++i) shift[i] = m;
+	for (size_type i = 0; i < m - 1; ++i) shift[bytes[i]] = m - 1 - i;
+
+	const value_type last = bytes[m - 1];
+	for (size_type i = 0; i + m <= n;) {
+		const value_type c = buf[i + m - 1];
+		if (c == last && memcmp(buf + i, bytes.data(), m - 1) == 0) {
+			result.push_back(address + i);
+		}
+		i += shift[c];
+	}
+}
+
+Decoder::Decoder(void)
+	: base(0)
+	, segment(false)
+{}
+
+/// Returns the start address record, the end of file record if there was none.
+const Record & Decoder::start_address(void) const
+{
+	return start;
+}
+
+Parser::Parser(void)
+	: line(0)
+	, done(false)
+{}
+
+/// Returns the start address record, the end of file record if there was none.
+const Record & Parser::start_address(void) const
+{
+	return decoder.start_address();
+}
+
+HexData::HexData()
+{}
+
+HexData::const_iterator HexData::begin(void) const
+{
+	return data.begin();
+}
+
+HexData::const_iterator HexData::end(void) const
+{
+	return data.end();
+}
+
+HexData::iterator HexData::begin(void)
+{
+	return data.begin();
+}
+
+HexData::iterator HexData::end(void)
+{
+	return data.end();
+}
+
+HexData::const_iterator HexData::find(Region::address_type address) const
+{
+	for (auto i = data.begin(); i != data.end(); ++i) {
+		if (i->address() == address) return i;
+	}
+	return end();
+}
+
+HexData::iterator HexData::find(Region::address_type address)
+{
+	for (auto i = data.begin(); i != data.end(); ++i) {
+		if (i->address() == address) return i;
+	}
+	return end();
+}
+
+void HexData::erase(iterator i)
+{
+	data.erase(i);
+}
+
+void HexData::dump_data(std::ostream & os, unsigned int width) const
+{
+	for (auto i = data.begin(); i != data.end(); ++i) {
+		i->dump_data(os, width);
+	}
+}
+
+void HexData::dump_ihex(std::ostream & os, unsigned int width, unsigned int page_size) const
+{
+	for (auto i = data.begin(); i != data.end(); ++i) {
+		i->dump_ihex(os, width, page_size);
+	}
+	if (has_start_address()) os << start;
+	os << Record::eof();
+}
+
+/// Writes all regions as intel hex records to the buffer, as much as fits
+/// in complete records. Returns the size of the entire encoded data, which
+/// exceeds the size of the buffer if it was too small.
+size_t HexData::encode_ihex(char * buf, size_t size, unsigned int width, unsigned int page_size) const
+{
+	size_t total = 0;
+	auto sink = [buf, size, &total](const Record & rec) {
+		if (size - std::min(total, size) >= Record::MAX_ENCODED_SIZE) {
+			total += rec.encode(buf + total);
+			return;
+		}
+		char tmp[Record::MAX_ENCODED_SIZE];
+		const size_t n = rec.encode(tmp);
+		if (total + n <= size) memcpy(buf + total, tmp, n);
+		total += n;
+	};
+
+	for (auto i = data.begin(); i != data.end(); ++i) {
+		i->records(0, i->size(), width, page_size, sink);
+	}
+	if (has_start_address()) sink(start);
+	sink(Record::eof());
+	return total;
+}
+
+bool HexData::has_start_address(void) const
+{
+	return start.type() != Record::Type::END_OF_FILE;
+}
+
+/// Returns the start address record (start segment or linear address).
+const Record & HexData::start_address(void) const
+{
+	return start;
+}
+
+/// Drops all runs of the fill value longer than the threshold, regions
+/// are split accordingly.
+void HexData::trim(Region::value_type fill, Region::size_type threshold)
+{
+	Data result;
+	result.reserve(data.size());
+	for (auto i = data.begin(); i != data.end(); ++i) {
+		auto parts = i->trim(fill, threshold);
+		result.insert(result.end(), parts.begin(), parts.end());
+	}
+	data.swap(result);
+}
+
+/// Pads all regions with the fill value to start and end at page boundaries.
+/// Regions sharing a page are merged, the gap between them filled. The page
+/// size must be a power of two, not larger than 64kB. Regions are sorted
+/// by address afterwards.
+void HexData::pad(unsigned int page_size, Region::value_type fill)
+{
+	std::sort(data.begin(), data.end(),
+		[](const Region & a, const Region & b) { return a.address() < b.address(); });
+
+	const uint64_t mask = ~static_cast<uint64_t>(page_size - 1);
+
+	Data result;
+	for (auto i = data.begin(); i != data.end();) {
+		const uint64_t first = i->address() & mask;
+		uint64_t last = (i->address() + static_cast<uint64_t>(i->size()) + page_size - 1) & mask;
+
+		// all regions sharing a page with the current group
+		auto j = i + 1;
+		for (; j != data.end() && (j->address() & mask) < last; ++j) {
+			last = std::max(last, (j->address() + static_cast<uint64_t>(j->size()) + page_size - 1) & mask);
+		}
+
+		Region region = Region::create(first, last - first, fill);
+		for (; i != j; ++i) {
+			region.write(i->address(), i->begin(), i->end());
+		}
+		result.push_back(region);
+	}
+	data.swap(result);
+}
+
+/// Determines the lowest and highest occupied address, returns false if
+/// there is no data at all.
+bool HexData::extent(Region::address_type & first, Region::address_type & last) const
+{
+	first = 0xffffffff;
+	last = 0;
+	for (auto i = data.begin(); i != data.end(); ++i) {
+		if (!i->size()) continue;
+		first = std::min(first, i->address());
+		last = std::max<Region::address_type>(last, i->address() + (i->size() - 1));
+	}
+	return first <= last;
+}
+
+/// Returns the regions intersecting the address window [first, last],
+/// in address order.
+std::vector<const Region *> HexData::window(Region::address_type first, Region::address_type last) const
+{
+	std::vector<const Region *> regions;
+	for (auto i = data.begin(); i != data.end(); ++i) {
+		if (i->size() && i->address() <= last && i->address() + (i->size() - 1) >= first) {
+			regions.push_back(&*i);
+		}
+	}
+	std::sort(regions.begin(), regions.end(),
+		[](const Region * a, const Region * b) { return a->address() < b->address(); });
+	return regions;
+}
+
+/// Returns the canonical image of all data: the data of all regions in
+/// address order. If gaps are filled, the range from the lowest to the
+/// highest occupied address is covered.
+std::vector<Region::value_type> HexData::image(bool fill_gaps, Region::value_type fill) const
+{
+	std::vector<Region::value_type> result;
+	image(fill_gaps, fill, [&result](const Region::value_type * p, size_t n) { result.insert(result.end(), p, p + n); });
+	return result;
+}
+
+/// Returns the canonical image of the data within the address window
+/// [first, last]: the data of all regions in address order. If gaps are
+/// filled, the entire window is covered, even if it contains no data.
+std::vector<Region::value_type> HexData::image(Region::address_type first, Region::address_type last,
+	bool fill_gaps, Region::value_type fill) const
+{
+	std::vector<Region::value_type> result;
+	image(first, last, fill_gaps, fill,
+		[&result](const Region::value_type * p, size_t n) { result.insert(result.end(), p, p + n); });
+	return result;
+}
+
+/// Writes the data to the specified address. If the address range is not
+/// occupied at all, a new region is created. Returns false if the range
+/// is only partially covered by existing regions, data outside is ignored.
+bool HexData::write(Region::address_type address, Region::const_iterator first, Region::const_iterator last)
+{
+	const Region::size_type n = last - first;
+
+	Region::size_type covered = 0;
+	for (auto i = data.begin(); i != data.end(); ++i) {
+		const uint64_t a = std::max<uint64_t>(address, i->address());
+		const uint64_t b = std::min<uint64_t>(static_cast<uint64_t>(address) + n, static_cast<uint64_t>(i->address()) + i->size());
+		if (a >= b) continue;
+		covered += b - a;
+		i->write(address, first, last);
+	}
+	if (covered) return covered == n;
+
+	if ((address & 0xffff0000) != ((address + (n - 1)) & 0xffff0000)) return false;
+	Region region = Region::create(address, n, 0);
+	region.write(address, first, last);
+	data.push_back(region);
+	return true;
+}
+
+/// Returns the parts of all regions within the address window [first, last],
+/// sorted by address.
+std::vector<HexData::Slice> HexData::slices(Region::address_type first, Region::address_type last) const
+{
+	std::vector<Slice> result;
+	for (auto i = data.begin(); i != data.end(); ++i) {
+		if (!i->size() || i->address() > last || i->address() + (i->size() - 1) < first) continue;
+		const Region::address_type a = std::max(first, i->address());
+		const Region::address_type b = std::min<Region::address_type>(last, i->address() + (i->size() - 1));
+		const Slice slice = { &*i, a - i->address(), static_cast<Region::size_type>(b - a) + 1 };
+		result.push_back(slice);
+	}
+	std::sort(result.begin(), result.end(),
+		[](const Slice & a, const Slice & b) { return a.address() < b.address(); });
+	return result;
+}
+
+/// Searches all regions for the pattern. Regions with contiguous addresses
+/// are searched as one, therefore matches across region boundaries are found.
+/// The resulting addresses are sorted in ascending order.
+std::vector<Region::address_type> HexData::search(const Pattern & pattern) const
+{
+	std::vector<Region::address_type> result;
+
+	std::vector<const Region *> regions;
+	regions.reserve(data.size());
+	for (auto i = data.begin(); i != data.end(); ++i) {
+		if (i->size()) regions.push_back(&*i);
+	}
+	std::sort(regions.begin(), regions.end(),
+		[](const Region * a, const Region * b) { return a->address() < b->address(); });
+
+	std::vector<Region::value_type> buffer;
+	for (auto i = regions.begin(); i != regions.end();) {
+		auto j = i + 1;
+		while (j != regions.end() && (*(j - 1))->address() + (*(j - 1))->size() == (*j)->address()) ++j;
+
+		if (j == i + 1) {
+			pattern.search(&*(*i)->begin(), (*i)->size(), (*i)->address(), result);
+		} else {
+			buffer.clear();
+			for (auto k = i; k != j; ++k) {
+				buffer.insert(buffer.end(), (*k)->begin(), (*k)->end());
+			}
+			pattern.search(buffer.data(), buffer.size(), (*i)->address(), result);
+		}
+		i = j;
+	}
+	return result;
+}
+
+void HexData::read_records(std::istream & is)
+{
+	auto emit = [this](const Region & region) { data.push_back(region); };
+
+	Parser parser;
+	std::vector<char> buffer(64 * 1024);
+	while (is.read(buffer.data(), buffer.size()) || is.gcount()) {
+		if (!parser.parse(buffer.data(), is.gcount(), emit)) break;
+	}
+	parser.finish(emit);
+	start = parser.start_address();
+}
+
+/// Reads records from the text in memory, see read_records.
+void HexData::read(const char * p, size_t n)
+{
+	auto emit = [this](const Region & region) { data.push_back(region); };
+
+	Parser parser;
+	parser.parse(p, n, emit);
+	parser.finish(emit);
+	start = parser.start_address();
+}
+
+template <class T> static T elf_value(T value, bool swap)
+{
+	if (!swap) return value;
+	T result = 0;
+	for (size_t i = 0; i < sizeof(T); ++i, value >>= 8) {
+		result = (result << 8) | (value & 0xff);
+	}
+	return result;
+}
+
+/// Reads the loadable segments of an ELF file, located in memory. Segments
+/// are placed at their physical addresses, split at 64kB boundaries.
+/// Uninitialized data (memory size exceeding the file size) is ignored.
+void HexData::read_elf(const uint8_t * p, size_t n)
+{
+	if (n < EI_NIDENT || memcmp(p, ELFMAG, SELFMAG) != 0) throw elf_exception("not an ELF file");
+
+	const uint16_t probe = 1;
+	const bool little_endian = *reinterpret_cast<const uint8_t *>(&probe) == 1;
+	bool swap;
+	switch (p[EI_DATA]) {
+		case ELFDATA2LSB: swap = !little_endian; break;
+		case ELFDATA2MSB: swap = little_endian; break;
+		default: throw elf_exception("unknown data encoding");
+	}
+
+	switch (p[EI_CLASS]) {
+		case ELFCLASS32: read_elf_segments<Elf32_Ehdr, Elf32_Phdr>(p, n, swap); break;
+		case ELFCLASS64: read_elf_segments<Elf64_Ehdr, Elf64_Phdr>(p, n, swap); break;
+		default: throw elf_exception("unknown class");
+	}
+
+	std::stable_sort(data.begin(), data.end(),
+		[](const Region & a, const Region & b) { return a.address() < b.address(); });
+}
+
+template <class Ehdr, class Phdr> void HexData::read_elf_segments(const uint8_t * p, size_t n, bool swap)
+{
+	if (n < sizeof(Ehdr)) throw elf_exception("file too small");
+	Ehdr ehdr;
+	memcpy(&ehdr, p, sizeof(ehdr));
+
+	const uint64_t entry = elf_value(ehdr.e_entry, swap);
+	if (entry && entry <= 0xffffffff) start = Record::start_linear(entry);
+
+	const uint64_t phoff = elf_value(ehdr.e_phoff, swap);
+	const uint64_t phentsize = elf_value(ehdr.e_phentsize, swap);
+	const uint64_t phnum = elf_value(ehdr.e_phnum, swap);
+	if (phnum && (phentsize < sizeof(Phdr) || phoff > n || phnum * phentsize > n - phoff)) {
+		throw elf_exception("invalid program header table");
+	}
+
+	for (uint64_t i = 0; i < phnum; ++i) {
+		Phdr phdr;
+		memcpy(&phdr, p + phoff + i * phentsize, sizeof(phdr));
+		if (elf_value(phdr.p_type, swap) != PT_LOAD) continue;
+
+		const uint64_t offset = elf_value(phdr.p_offset, swap);
+		const uint64_t size = elf_value(phdr.p_filesz, swap);
+		uint64_t address = elf_value(phdr.p_paddr, swap);
+		if (!size) continue;
+		if (offset > n || size > n - offset) throw elf_exception("segment exceeds file");
+		if (address + size > 0x100000000ull) throw elf_exception("segment exceeds 32 bit address space");
+
+		for (const uint8_t * q = p + offset, * last = q + size; q != last;) {
+			const uint64_t k = std::min<uint64_t>(last - q, 0x10000 - (address & 0xffff));
+			data.push_back(Region::create(address, q, k));
+			q += k;
+			address += k;
+		}
+	}
+}
+
+Sha256::Sha256(void)
+	: block_size(0)
+	, total_size(0)
+{
+	static const uint32_t IV[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+	};
+	std::copy(IV, IV + 8, state);
+}
+
+static inline uint32_t rotr(uint32_t x, unsigned int n)
+{
+	return (x >> n) | (x << (32 - n));
+}
+
+void Sha256::compress(const value_type * p)
+{
+	static const uint32_t K[64] = {
+		0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+		0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+		0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+		0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+		0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+		0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+		0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+		0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+	};
+
+	uint32_t w[64];
+	for (int i = 0; i < 16; ++i) {
+		w[i] = (uint32_t(p[i * 4]) << 24) | (uint32_t(p[i * 4 + 1]) << 16) | (uint32_t(p[i * 4 + 2]) << 8) | p[i * 4 + 3];
+	}
+	for (int i = 16; i < 64; ++i) {
+		const uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+		const uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+		w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+	}
+
+	uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+	uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+	for (int i = 0; i < 64; ++i) {
+		const uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+		const uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+		h = g;
+		g = f;
+		f = e;
+		e = d + t1;
+		d = c;
+		c = b;
+		b = a;
+		a = t1 + t2;
+	}
+	state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+	state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+void Sha256::update(const value_type * p, size_t n)
+{
+	total_size += n;
+	if (block_size) {
+		const size_t k = std::min(n, sizeof(block) - block_size);
+		memcpy(block + block_size, p, k);
+		block_size += k;
+		p += k;
+		n -= k;
+		if (block_size < sizeof(block)) return;
+		compress(block);
+		block_size = 0;
+	}
+	for (; n >= sizeof(block); p += sizeof(block), n -= sizeof(block)) {
+		compress(p);
+	}
+	memcpy(block, p, n);
+	block_size = n;
+}
+
+Sha256::Digest Sha256::digest(void)
+{
+	const uint64_t bits = total_size * 8;
+
+	value_type padding[72] = { 0x80 };
+	const size_t n = ((block_size < 56) ? 56 : 120) - block_size;
+	for (int i = 0; i < 8; ++i) padding[n + i] = (bits >> (56 - i * 8)) & 0xff;
+	update(padding, n + 8);
+
+	Digest result;
+	for (int i = 0; i < 8; ++i) {
+		for (int j = 24; j >= 0; j -= 8) result.push_back((state[i] >> j) & 0xff);
+	}
+	return result;
+}
+
+Sha256::Digest Sha256::hash(const value_type * p, size_t n)
+{
+	Sha256 sha;
+	sha.update(p, n);
+	return sha.digest();
+}
+
+const uint32_t Blake3::IV[8] = {
+	0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+void Blake3::compress(const uint32_t cv[8], const uint32_t block[16], uint64_t counter,
+	uint32_t block_len, uint32_t flags, uint32_t result[16])
+{
+	static const unsigned int PERMUTATION[16] = { 2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8 };
+
+	uint32_t * v = result;
+	std::copy(cv, cv + 8, v);
+	std::copy(IV, IV + 4, v + 8);
+	v[12] = static_cast<uint32_t>(counter);
+	v[13] = static_cast<uint32_t>(counter >> 32);
+	v[14] = block_len;
+	v[15] = flags;
+
+	uint32_t m[16];
+	std::copy(block, block + 16, m);
+
+	auto g = [v](int a, int b, int c, int d, uint32_t x, uint32_t y) {
+		v[a] = v[a] + v[b] + x; v[d] = rotr(v[d] ^ v[a], 16);
+		v[c] = v[c] + v[d];     v[b] = rotr(v[b] ^ v[c], 12);
+		v[a] = v[a] + v[b] + y; v[d] = rotr(v[d] ^ v[a], 8);
+		v[c] = v[c] + v[d];     v[b] = rotr(v[b] ^ v[c], 7);
+	};
+
+	for (int round = 0; round < 7; ++round) {
+		g(0, 4,  8, 12, m[ 0], m[ 1]);
+		g(1, 5,  9, 13, m[ 2], m[ 3]);
+		g(2, 6, 10, 14, m[ 4], m[ 5]);
+		g(3, 7, 11, 15, m[ 6], m[ 7]);
+		g(0, 5, 10, 15, m[ 8], m[ 9]);
+		g(1, 6, 11, 12, m[10], m[11]);
+		g(2, 7,  8, 13, m[12], m[13]);
+		g(3, 4,  9, 14, m[14], m[15]);
+
+		uint32_t t[16];
+		for (int i = 0; i < 16; ++i) t[i] = m[PERMUTATION[i]];
+		std::copy(t, t + 16, m);
+	}
+
+	for (int i = 0; i < 8; ++i) {
+		v[i] ^= v[i + 8];
+		v[i + 8] ^= cv[i];
+	}
+}
+
+void Blake3::Output::compress(uint32_t extra_flags, uint32_t result[16]) const
+{
+	Blake3::compress(cv, block, counter, block_len, flags | extra_flags, result);
+}
+
+void Blake3::Output::chaining_value(uint32_t result[8]) const
+{
+	uint32_t v[16];
+	compress(0, v);
+	std::copy(v, v + 8, result);
+}
+
+void Blake3::load_block(const value_type * p, size_t n, uint32_t block[16])
+{
+	value_type bytes[BLOCK_LEN] = { 0 };
+	if (n) memcpy(bytes, p, n);
+	for (int i = 0; i < 16; ++i) {
+		block[i] = uint32_t(bytes[i * 4]) | (uint32_t(bytes[i * 4 + 1]) << 8)
+			| (uint32_t(bytes[i * 4 + 2]) << 16) | (uint32_t(bytes[i * 4 + 3]) << 24);
+	}
+}
+
+Blake3::Output Blake3::chunk(const value_type * p, size_t n, uint64_t counter)
+{
+	Output out;
+	std::copy(IV, IV + 8, out.cv);
+	out.counter = counter;
+	out.flags = CHUNK_START;
+
+	// all blocks except the last one are compressed into the chaining value
+	for (; n > BLOCK_LEN; p += BLOCK_LEN, n -= BLOCK_LEN) {
+		uint32_t v[16];
+		load_block(p, BLOCK_LEN, out.block);
+		compress(out.cv, out.block, counter, BLOCK_LEN, out.flags, v);
+		std::copy(v, v + 8, out.cv);
+		out.flags = 0;
+	}
+	load_block(p, n, out.block);
+	out.block_len = static_cast<uint32_t>(n);
+	out.flags |= CHUNK_END;
+	return out;
+}
+
+Blake3::Output Blake3::parent(const uint32_t left[8], const uint32_t right[8])
+{
+	Output out;
+	std::copy(IV, IV + 8, out.cv);
+	std::copy(left, left + 8, out.block);
+	std::copy(right, right + 8, out.block + 8);
+	out.counter = 0;
+	out.block_len = BLOCK_LEN;
+	out.flags = PARENT;
+	return out;
+}
+
+Blake3::Output Blake3::subtree(const value_type * p, size_t n, uint64_t counter, unsigned int threads)
+{
+	if (n <= CHUNK_LEN) return chunk(p, n, counter);
+
+	// the left subtree contains the largest power of two of complete chunks
+	size_t left = CHUNK_LEN;
+	while (left * 2 < n) left *= 2;
+
+	uint32_t left_cv[8];
+	uint32_t right_cv[8];
+	if (threads > 1) {
+		std::thread worker([&]() {
+			subtree(p, left, counter, threads / 2).chaining_value(left_cv);
+		});
+		subtree(p + left, n - left, counter + left / CHUNK_LEN, threads - threads / 2).chaining_value(right_cv);
+		worker.join();
+	} else {
+		subtree(p, left, counter, 1).chaining_value(left_cv);
+		subtree(p + left, n - left, counter + left / CHUNK_LEN, 1).chaining_value(right_cv);
+	}
+	return parent(left_cv, right_cv);
+}
+
+Blake3::Digest Blake3::hash(const value_type * p, size_t n, unsigned int threads)
+{
+	// not worth to spawn threads for small subtrees
+	threads = std::max(1u, std::min<unsigned int>(threads, n / (64 * CHUNK_LEN)));
+
+	uint32_t v[16];
+	subtree(p, n, 0, threads).compress(ROOT, v);
+
+	Digest result;
+	for (int i = 0; i < 8; ++i) {
+		for (int j = 0; j < 32; j += 8) result.push_back((v[i] >> j) & 0xff);
+	}
+	return result;
+}
+
+}
+
+struct ihex_data
+{
+	ihex::HexData hex;
+};
+
+ihex_data * ihex_create(void)
+{
+	return new (std::nothrow) ihex_data;
+}
+
+void ihex_destroy(ihex_data * data)
+{
+	delete data;
+}
+
+int ihex_parse(ihex_data * data, const char * text, size_t size, int * line)
+{
+	if (!data || (!text && size)) return IHEX_ERROR_ARGUMENT;
+	try {
+		data->hex.read(text, size);
+	} catch (ihex::Record::checksum_exception & e) {
+		if (line) *line = e.line;
+		return IHEX_ERROR_CHECKSUM;
+	} catch (ihex::Record::unknown_type_exception &) {
+		return IHEX_ERROR_RECORD_TYPE;
+	} catch (ihex::Region::continuous_exception &) {
+		return IHEX_ERROR_CONTINUITY;
+	} catch (std::bad_alloc &) {
+		return IHEX_ERROR_MEMORY;
+	} catch (...) {
+		return IHEX_ERROR_INTERNAL;
+	}
+	return IHEX_OK;
+}
+
+int ihex_parse_elf(ihex_data * data, const uint8_t * p, size_t size)
+{
+	if (!data || !p) return IHEX_ERROR_ARGUMENT;
+	try {
+		data->hex.read_elf(p, size);
+	} catch (ihex::HexData::elf_exception &) {
+		return IHEX_ERROR_ELF;
+	} catch (std::bad_alloc &) {
+		return IHEX_ERROR_MEMORY;
+	} catch (...) {
+		return IHEX_ERROR_INTERNAL;
+	}
+	return IHEX_OK;
+}
+
+size_t ihex_region_count(const ihex_data * data)
+{
+	if (!data) return 0;
+	return data->hex.end() - data->hex.begin();
+}
+
+int ihex_start_address(const ihex_data * data, int * type, uint32_t * address)
+{
+	if (!data) return IHEX_ERROR_ARGUMENT;
+	if (!data->hex.has_start_address()) return 0;
+	const ihex::Record & start = data->hex.start_address();
+	if (type) *type = start.type();
+	if (address) *address = start.address();
+	return 1;
+}
+
+int ihex_region(const ihex_data * data, size_t index, uint32_t * address, const uint8_t ** p, size_t * size)
+{
+	if (!data || index >= ihex_region_count(data)) return IHEX_ERROR_ARGUMENT;
+	const ihex::Region & region = *(data->hex.begin() + index);
+	if (address) *address = region.address();
+	if (p) *p = region.bytes();
+	if (size) *size = region.size();
+	return IHEX_OK;
+}
+
+size_t ihex_encode(const ihex_data * data, char * buffer, size_t size, unsigned int width)
+{
+	if (!data) return 0;
+	if (!buffer) size = 0;
+	if (width < 1) width = 1;
+	if (width > 255) width = 255;
+	try {
+		return data->hex.encode_ihex(buffer, size, width);
+	} catch (...) {
+		return 0;
+	}
+}
@@ -0,0 +1,61 @@
+/* libihex.h
+ * (c) 2015 Mario Konrad <mario.konrad@gmx.net>
+ *
+ * this software is distributed under the license: GPLv2 (http://www.gnu.org/licenses/gpl-2.0.html)
+ */
+
+#ifndef LIBIHEX_H
+#define LIBIHEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* opaque handle to the memory image (regions) */
+typedef struct ihex_data ihex_data;
+
+enum ihex_result {
+	 IHEX_OK                =  0
+	,IHEX_ERROR_ARGUMENT    = -1
+	,IHEX_ERROR_CHECKSUM    = -2
+	,IHEX_ERROR_RECORD_TYPE = -3
+	,IHEX_ERROR_CONTINUITY  = -4
+	,IHEX_ERROR_ELF         = -5
+	,IHEX_ERROR_MEMORY      = -6
+	,IHEX_ERROR_INTERNAL    = -7
+};
+
+ihex_data * ihex_create(void);
+void ihex_destroy(ihex_data *);
+
+/* parses intel hex text, the regions are appended. on IHEX_ERROR_CHECKSUM
+ * the line is stored in 'line' (if not NULL), it is left unchanged on all
+ * other results. */
+int ihex_parse(ihex_data *, const char * text, size_t size, int * line);
+
+/* reads the loadable segments of an ELF file in memory, the regions are appended */
+int ihex_parse_elf(ihex_data *, const uint8_t * data, size_t size);
+
+size_t ihex_region_count(const ihex_data *);
+
+/* start address record, type is 3 (CS:IP, address is CS << 16 | IP) or 5
+ * (linear address). returns 1 if present, 0 if there is none */
+int ihex_start_address(const ihex_data *, int * type, uint32_t * address);
+
+/* returns address and data of the region, the data is valid until
+ * the handle is modified or destroyed */
+int ihex_region(const ihex_data *, size_t index, uint32_t * address, const uint8_t ** data, size_t * size);
+
+/* writes the intel hex text into the buffer, as much as fits in complete
+ * records. returns the size of the entire text, which exceeds the buffer
+ * size if the buffer was too small. */
+size_t ihex_encode(const ihex_data *, char * buffer, size_t size, unsigned int width);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,547 @@
+// libihex.hpp
+// (c) 2015 Mario Konrad <mario.konrad@gmx.net>
+//
+// this software is distributed under the license: GPLv2 (http://www.gnu.org/licenses/gpl-2.0.html)
+
+#ifndef LIBIHEX_HPP
+#define LIBIHEX_HPP
+
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <exception>
+#include <algorithm>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+namespace ihex
+{
+
+class Record
+{
+	public:
+		enum Type : uint8_t {
+			 DATA              = 0x00
+			,END_OF_FILE       = 0x01
+			,EXT_SEG_ADDRESS   = 0x02
+			,START_SEG_ADDRESS = 0x03
+			,EXT_LIN_ADDRESS   = 0x04
+			,START_LIN_ADDRESS = 0x05
+		};
+
+		typedef uint8_t value_type;
+		typedef std::vector<value_type> Data;
+		typedef Data::size_type size_type;
+		typedef uint8_t checksum_type;
+		typedef uint16_t offset_type;
+		typedef uint32_t address_type;
+		typedef Data::const_iterator const_iterator;
+
+		/// Maximum number of characters of an encoded record, including newline.
+		static const size_t MAX_ENCODED_SIZE = 1 + 2 + 4 + 2 + 255 * 2 + 2 + 1;
+
+		class checksum_exception : public std::exception
+		{
+			public:
+				checksum_type checksum;
+				checksum_type calculated;
+				int line;
+			public:
+				checksum_exception(checksum_type checksum, checksum_type calculated)
+					: checksum(checksum)
+					, calculated(calculated)
+					, line(-1)
+				{}
+
+				checksum_exception(const checksum_exception & ex, int line)
+					: checksum(ex.checksum)
+					, calculated(ex.calculated)
+					, line(line)
+				{}
+		};
+
+		class unknown_type_exception : public std::exception
+		{
+			public:
+				Type type;
+			public:
+				unknown_type_exception(Type type)
+					: type(type)
+				{}
+		};
+	private:
+		offset_type off;
+		Type t;
+		Data bytes;
+	public:
+		Record(void);
+		explicit Record(Type);
+		explicit Record(address_type);
+
+		void push_back(value_type);
+
+		Type type(void) const;
+		checksum_type checksum(void) const;
+		size_type size(void) const;
+		offset_type offset(void) const;
+
+		const_iterator begin(void) const;
+		const_iterator end(void) const;
+
+		address_type address(void) const;
+
+		size_t encode(char *) const;
+
+		static Record create_data(address_type);
+		static Record start_linear(address_type);
+		static Record eof(void);
+		static Record parse(const char *, size_t); // throws checksum_exception, unknown_type_exception
+
+		friend std::istream & operator >> (std::istream &, Record &); // throws as parse
+		friend std::ostream & operator << (std::ostream &, const Record &);
+};
+
+class Region
+{
+	public:
+		class continuous_exception : public std::exception {};
+		typedef Record::address_type address_type;
+		typedef Record::value_type value_type;
+	private:
+		typedef std::vector<value_type> Data;
+		typedef Record::offset_type offset_type;
+	public:
+		typedef Data::size_type size_type;
+		typedef Data::const_iterator const_iterator;
+
+		struct Statistics
+		{
+			size_type fill; // number of bytes equal to the fill value
+			size_type longest_run; // longest run of the fill value
+			double entropy; // bits per byte
+		};
+	private:
+		Data data; // max size 64kB, since offset of hex file is 16 bits
+		address_type base_address;
+		offset_type offset;
+		bool offset_already_set;
+	public:
+		Region(address_type = 0);
+		void insert(offset_type, value_type); // throws continuous_exception
+		size_type size(void) const;
+		const_iterator begin(void) const;
+		const_iterator end(void) const;
+		const value_type * bytes(void) const;
+		void dump_data(std::ostream &, unsigned int = 16) const;
+		void dump_ihex(std::ostream &, unsigned int = 32, unsigned int = 0) const;
+		void dump_ihex(std::ostream &, size_type, size_type, unsigned int, unsigned int) const;
+		template <class Sink> void records(size_type, size_type, unsigned int, unsigned int, Sink) const;
+		address_type address(void) const;
+		void move_base_address(address_type);
+		bool inside(address_type) const;
+		void write(address_type, const_iterator, const_iterator);
+		Region slice(size_type, size_type) const;
+		std::vector<Region> trim(value_type, size_type) const;
+		Statistics statistics(value_type) const;
+
+		static Region create(address_type, size_type, value_type);
+		static Region create(address_type, const value_type *, size_type);
+};
+
+/// Passes the specified part of the region as intel hex records to the sink,
+/// starting with the extended linear address record. If a page size is
+/// specified, records are aligned to multiples of the width and never cross
+/// a page boundary.
+template <class Sink> void Region::records(size_type pos, size_type n, unsigned int width, unsigned int page_size, Sink sink) const
+{
+	enum class State {
+		 NEW_RECORD
+		,DATA
+	};
+
+	address_type address = base_address + pos;
+	State state = State::NEW_RECORD;
+	Record rec;
+
+	sink(Record(base_address));
+	const auto last = data.begin() + pos + n;
+	for (auto i = data.begin() + pos; i != last;) {
+		switch (state) {
+			case State::NEW_RECORD:
+				rec = Record::create_data(address + offset);
+				state = State::DATA;
+				break;
+
+			case State::DATA:
+				if ((rec.size() >= width) || (page_size && rec.size()
+					&& (((address + offset) % width == 0) || ((address + offset) % page_size == 0)))) {
+					sink(rec);
+					state = State::NEW_RECORD;
+					break;
+				}
+				rec.push_back(*i);
+				++address;
+				++i;
+				if (i == last) {
+					sink(rec);
+				}
+				break;
+		}
+	}
+}
+
+class Pattern
+{
+	public:
+		typedef uint8_t value_type;
+		typedef std::vector<value_type> Data;
+		typedef Data::size_type size_type;
+	private:
+		Data bytes;
+		Data mask; // empty if all bytes have to match exactly
+	public:
+		Pattern(void);
+		Pattern(const Data &, const Data & = Data());
+
+		size_type size(void) const;
+		bool match(const value_type *) const;
+		void search(const value_type *, size_type, Record::address_type, std::vector<Record::address_type> &) const;
+	private:
+		void search_anchor(const value_type *, size_type, Record::address_type, std::vector<Record::address_type> &) const;
+		void search_horspool(const value_type *, size_type, Record::address_type, std::vector<Record::address_type> &) const;
+};
+
+/// Assembles regions from a sequence of records.
+///
+/// Extended segment and linear address records set the base address, data
+/// records are placed at the base address plus their offset. After a segment
+/// address record the offset wraps around within the 64kB segment, after a
+/// linear address record it continues across it. Regions are split at 64kB
+/// boundaries.
+class Decoder
+{
+	private:
+		Region region;
+		Record::address_type base;
+		bool segment; // segment addressing, offsets wrap around
+		Record start;
+	public:
+		Decoder(void);
+		template <class Emit> bool process(const Record &, Emit); // throws Region::continuous_exception
+		template <class Emit> void finish(Emit);
+		const Record & start_address(void) const;
+};
+
+/// Processes one record, completed regions are passed to the emit function.
+/// Returns false if the end of file record was processed.
+template <class Emit> bool Decoder::process(const Record & rec, Emit emit)
+{
+	switch (rec.type()) {
+		case Record::Type::DATA:
+			{
+				Record::address_type offset = rec.offset();
+				Record::address_type address = base + offset;
+				auto i = rec.begin();
+				while (i != rec.end()) {
+					if (!region.size()) {
+						region = Region(address & 0xffff0000);
+					} else if ((address ^ region.address()) & 0xffff0000) {
+						// continues in the next 64kB segment
+						if (address != region.address() + region.size()) throw Region::continuous_exception();
+						finish(emit);
+						region = Region(address & 0xffff0000);
+					}
+					auto n = std::min<Record::size_type>(rec.end() - i, 0x10000 - (address & 0xffff));
+					if (segment) n = std::min<Record::size_type>(n, 0x10000 - offset);
+					for (auto last = i + n; i != last; ++i) {
+						region.insert(address & 0xffff, *i);
+					}
+					address += n;
+					offset += n;
+					if (segment && offset == 0x10000 && i != rec.end()) {
+						// the rest wraps around to the start of the segment
+						finish(emit);
+						offset = 0;
+						address = base;
+					}
+				}
+			}
+			break;
+
+		case Record::Type::END_OF_FILE:
+			finish(emit);
+			return false;
+
+		case Record::Type::EXT_SEG_ADDRESS:
+		case Record::Type::EXT_LIN_ADDRESS:
+			finish(emit);
+			base = rec.address();
+			segment = (rec.type() == Record::Type::EXT_SEG_ADDRESS);
+			break;
+
+		case Record::Type::START_SEG_ADDRESS:
+		case Record::Type::START_LIN_ADDRESS:
+			start = rec;
+			break;
+	}
+	return true;
+}
+
+template <class Emit> void Decoder::finish(Emit emit)
+{
+	if (region.size()) {
+		emit(region);
+	}
+	region = Region();
+}
+
+/// Parses intel hex text and assembles regions from its records. The text
+/// may be passed in pieces split anywhere, lines are counted to report the
+/// line of checksum errors.
+class Parser
+{
+	private:
+		Decoder decoder;
+		std::string partial; // incomplete last line of the previous piece
+		int line;
+		bool done; // end of file record processed
+
+		template <class Emit> void parse_line(const char *, size_t, Emit);
+	public:
+		Parser(void);
+		// throws Record::checksum_exception, Record::unknown_type_exception
+		// and Region::continuous_exception
+		template <class Emit> bool parse(const char *, size_t, Emit);
+		template <class Emit> void finish(Emit);
+		const Record & start_address(void) const;
+};
+
+template <class Emit> void Parser::parse_line(const char * p, size_t n, Emit emit)
+{
+	++line;
+	Record rec;
+	try {
+		rec = Record::parse(p, n);
+	} catch (const Record::checksum_exception & e) {
+		throw Record::checksum_exception(e, line);
+	}
+	done = !decoder.process(rec, emit);
+}
+
+/// Parses the next piece of text, completed regions are passed to the emit
+/// function. Returns false if the end of file record was processed, text
+/// after it is ignored.
+template <class Emit> bool Parser::parse(const char * p, size_t n, Emit emit)
+{
+	const char * last = p + n;
+	while (!done && p != last) {
+		const char * end = static_cast<const char *>(memchr(p, '\n', last - p));
+		if (!end) {
+			partial.append(p, last);
+			break;
+		}
+		if (partial.size()) {
+			partial.append(p, end);
+			parse_line(partial.data(), partial.size(), emit);
+			partial.clear();
+		} else {
+			parse_line(p, end - p, emit);
+		}
+		p = end + 1;
+	}
+	return !done;
+}
+
+/// Ends the text, parses a last line without newline and passes the last
+/// region, also if there was no end of file record.
+template <class Emit> void Parser::finish(Emit emit)
+{
+	if (!done && partial.size()) {
+		parse_line(partial.data(), partial.size(), emit);
+		partial.clear();
+	}
+	decoder.finish(emit);
+}
+
+class HexData
+{
+	private:
+		typedef std::vector<Region> Data;
+	public:
+		typedef Data::const_iterator const_iterator;
+		typedef Data::iterator iterator;
+
+		/// Part of a region, refers to the data of the region without copying.
+		struct Slice
+		{
+			const Region * region;
+			Region::size_type pos;
+			Region::size_type size;
+
+			Region::address_type address(void) const { return region->address() + pos; }
+		};
+
+		class elf_exception : public std::exception
+		{
+			public:
+				std::string text;
+			public:
+				elf_exception(const std::string & text)
+					: text("ELF: " + text)
+				{}
+
+				virtual ~elf_exception() noexcept {}
+
+				virtual const char * what() const noexcept
+				{
+					return text.c_str();
+				}
+		};
+	private:
+		Data data;
+		Record start; // start address record, end of file record if there is none
+
+		template <class Ehdr, class Phdr> void read_elf_segments(const uint8_t *, size_t, bool);
+		bool extent(Region::address_type &, Region::address_type &) const;
+		std::vector<const Region *> window(Region::address_type, Region::address_type) const;
+	public:
+		HexData();
+		// reading throws Record::checksum_exception, Record::unknown_type_exception
+		// and Region::continuous_exception, reading ELF throws elf_exception
+		void read_records(std::istream & is);
+		void read(const char *, size_t);
+		void read_elf(const uint8_t *, size_t);
+		bool has_start_address(void) const;
+		const Record & start_address(void) const;
+		void dump_data(std::ostream &, unsigned int = 16) const;
+		void dump_ihex(std::ostream &, unsigned int = 32, unsigned int = 0) const;
+		size_t encode_ihex(char *, size_t, unsigned int = 32, unsigned int = 0) const;
+		std::vector<Region::address_type> search(const Pattern &) const;
+		void trim(Region::value_type, Region::size_type);
+		void pad(unsigned int, Region::value_type);
+		std::vector<Region::value_type> image(bool, Region::value_type) const;
+		std::vector<Region::value_type> image(Region::address_type, Region::address_type,
+			bool, Region::value_type) const;
+		template <class Sink> void image(bool, Region::value_type, Sink) const;
+		template <class Sink> void image(Region::address_type, Region::address_type,
+			bool, Region::value_type, Sink) const;
+		bool write(Region::address_type, Region::const_iterator, Region::const_iterator);
+		std::vector<Slice> slices(Region::address_type, Region::address_type) const;
+
+		const_iterator find(Region::address_type) const;
+		const_iterator begin(void) const;
+		const_iterator end(void) const;
+
+		iterator find(Region::address_type);
+		iterator begin(void);
+		iterator end(void);
+		void erase(iterator);
+};
+
+/// Passes the canonical image of all data in pieces to the sink, see image().
+template <class Sink> void HexData::image(bool fill_gaps, Region::value_type fill, Sink sink) const
+{
+	Region::address_type first;
+	Region::address_type last;
+	if (extent(first, last)) image(first, last, fill_gaps, fill, sink);
+}
+
+/// Passes the canonical image of the address window in pieces to the sink,
+/// called as sink(const Region::value_type *, size_t), without copying the
+/// data of the regions. Gaps are passed in pieces of fill bytes, the image is
+/// never entirely held in memory. Data overlapping preceding data is skipped.
+template <class Sink> void HexData::image(Region::address_type first, Region::address_type last,
+	bool fill_gaps, Region::value_type fill, Sink sink) const
+{
+	const std::vector<Region::value_type> gap(fill_gaps ? 4096 : 0, fill);
+	auto fill_to = [&](uint64_t & next, uint64_t end) {
+		for (; next < end; next += std::min<uint64_t>(end - next, gap.size())) {
+			sink(gap.data(), static_cast<size_t>(std::min<uint64_t>(end - next, gap.size())));
+		}
+	};
+
+	uint64_t next = first; // next address of the image
+	const auto regions = window(first, last);
+	for (auto i = regions.begin(); i != regions.end(); ++i) {
+		const uint64_t a = std::max<uint64_t>(first, (*i)->address());
+		const uint64_t b = std::min<uint64_t>(last, (*i)->address() + ((*i)->size() - 1)) + 1;
+		if (fill_gaps) {
+			fill_to(next, a);
+			if (next >= b) continue;
+			sink((*i)->bytes() + (next - (*i)->address()), static_cast<size_t>(b - next));
+			next = b;
+		} else {
+			sink((*i)->bytes() + (a - (*i)->address()), static_cast<size_t>(b - a));
+		}
+	}
+	if (fill_gaps) fill_to(next, static_cast<uint64_t>(last) + 1);
+}
+
+class Sha256
+{
+	public:
+		typedef uint8_t value_type;
+		typedef std::vector<value_type> Digest;
+	private:
+		uint32_t state[8];
+		value_type block[64];
+		size_t block_size;
+		uint64_t total_size;
+
+		void compress(const value_type *);
+	public:
+		Sha256(void);
+		void update(const value_type *, size_t);
+		Digest digest(void);
+
+		static Digest hash(const value_type *, size_t);
+};
+
+/// BLAKE3 hash (unkeyed, 256 bit output). Subtrees of the chunk tree are
+/// hashed concurrently, the result does not depend on the number of threads.
+class Blake3
+{
+	public:
+		typedef uint8_t value_type;
+		typedef std::vector<value_type> Digest;
+	private:
+		enum Flags : uint32_t {
+			 CHUNK_START = 1 << 0
+			,CHUNK_END   = 1 << 1
+			,PARENT      = 1 << 2
+			,ROOT        = 1 << 3
+		};
+
+		static const size_t BLOCK_LEN = 64;
+		static const size_t CHUNK_LEN = 1024;
+		static const uint32_t IV[8];
+
+		/// Input of the last compression of a node, needed to finalize
+		/// it either as chaining value or as root.
+		struct Output
+		{
+			uint32_t cv[8];
+			uint32_t block[16];
+			uint64_t counter;
+			uint32_t block_len;
+			uint32_t flags;
+
+			void compress(uint32_t flags, uint32_t result[16]) const;
+			void chaining_value(uint32_t result[8]) const;
+		};
+
+		static void compress(const uint32_t cv[8], const uint32_t block[16], uint64_t counter,
+			uint32_t block_len, uint32_t flags, uint32_t result[16]);
+		static void load_block(const value_type *, size_t, uint32_t block[16]);
+		static Output chunk(const value_type *, size_t, uint64_t);
+		static Output parent(const uint32_t left[8], const uint32_t right[8]);
+		static Output subtree(const value_type *, size_t, uint64_t, unsigned int);
+	public:
+		static Digest hash(const value_type *, size_t, unsigned int = 1);
+};
+
+}
+
+#endif